@@ -1,13 +1,25 @@
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
 #include <cmath>
+#include <functional>
 #include <random>
+#include <span>
 #include <vector>
 
 #include "cvs.h"
 #include "daltonlens.h"
+#ifdef CVS_HAS_OPENCL
 #include "daltonlens_cl.h"
+#endif
+#ifdef CVS_HAS_OPENMP
 #include "daltonlens_omp.h"
+#endif
+#include "daltonlens_par.h"
+#include "dedup.h"
+#include "frame_buffer.h"
+#include "half.h"
+#include "incremental.h"
 
 using cvs::BGRA;
 using cvs::Deficiency;
@@ -16,37 +28,135 @@ const int kMaxSize = 10'000'000;
 
 #define BM_RANGE RangeMultiplier(10)->Range(10, kMaxSize)
 
+// Google Benchmark constructs the fixture of every family at registration, so
+// frames are allocated on first use instead, and shared by all the families of
+// a fixture.
+struct Frames {
+  cvs::FrameBuffer src{ kMaxSize };
+  cvs::FrameBuffer dst{ kMaxSize };
+
+  explicit Frames(const std::function<uint32_t(size_t)>& pixel) {
+    for (size_t i = 0; i < kMaxSize; i++) {
+      ((uint32_t*)(src.data()))[i] = pixel(i);
+    }
+  }
+};
+
 class MyFixture : public benchmark::Fixture {
  public:
-  std::vector<BGRA> src;
-  std::vector<BGRA> dst;
+  std::span<BGRA> src;
+  std::span<BGRA> dst;
 
-  std::mt19937 mt;
-
-  MyFixture() {
-    src.resize(kMaxSize);
-    dst.resize(kMaxSize);
+  // With Threads(n) every thread calls SetUp on the one shared fixture. Only
+  // the first one sets it up; the others wait at the start of the timing loop
+  // until it is done.
+  void SetUp(const benchmark::State& st) override {
+    if (st.thread_index() != 0) return;
+    static Frames frames([mt = std::mt19937(std::random_device{}())](
+                             size_t) mutable { return uint32_t(mt()); });
+    src = { frames.src.data(), frames.src.size() };
+    dst = { frames.dst.data(), frames.dst.size() };
+  }
+};
 
-    std::random_device rnd;
-    mt.seed(rnd());
+// The same frames in std::vector, without the alignment and huge pages of
+// FrameBuffer.
+class VectorFixture : public benchmark::Fixture {
+ public:
+  std::span<BGRA> src;
+  std::span<BGRA> dst;
 
-    for (size_t i = 0; i < kMaxSize; i++) {
-      ((uint32_t*)(src.data()))[i] = mt();
-    }
+  void SetUp(const benchmark::State&) override {
+    static std::vector<BGRA> src_frame(kMaxSize);
+    static std::vector<BGRA> dst_frame(kMaxSize);
+    static const bool filled = [] {
+      std::mt19937 mt(std::random_device{}());
+      for (size_t i = 0; i < kMaxSize; i++) {
+        ((uint32_t*)(src_frame.data()))[i] = mt();
+      }
+      return true;
+    }();
+    (void)filled;
+    src = src_frame;
+    dst = dst_frame;
   }
 };
 
+#ifdef CVS_HAS_OPENCL
 class CLFixture : public MyFixture {
  public:
   cl::Context context;
-  cl::CommandQueue queue;
   cvs::daltonlens_cl::Simulator sim;
+  bool warmed_up = false;
+
+  CLFixture() : context(CL_DEVICE_TYPE_DEFAULT), sim(context) {}
 
-  CLFixture()
-      : context(CL_DEVICE_TYPE_DEFAULT), queue(context), sim(context, queue) {
+  void SetUp(const benchmark::State& st) override {
+    MyFixture::SetUp(st);
+    if (st.thread_index() != 0 || warmed_up) return;
     for (int i = 0; i < 10; i++) {
       sim.Vienot1999(Deficiency::Protan, 1.f, src.data(), dst.data(), kMaxSize);
     }
+    warmed_up = true;
+  }
+};
+#endif
+
+// UI screenshots and charts: a few thousand colours in flat runs.
+class PaletteFixture : public MyFixture {
+ public:
+  void SetUp(const benchmark::State&) override {
+    static Frames frames([palette = make_palette()](size_t i) {
+      return palette[(i / 37) % palette.size()];
+    });
+    src = { frames.src.data(), frames.src.size() };
+    dst = { frames.dst.data(), frames.dst.size() };
+  }
+
+ private:
+  static std::vector<uint32_t> make_palette() {
+    std::mt19937 mt(std::random_device{}());
+    std::vector<uint32_t> palette(4096);
+    for (auto& c : palette) c = mt();
+    return palette;
+  }
+};
+
+// Linear-light RGBA frames, as float and as half.
+struct LinearFrames {
+  std::vector<float> src;
+  std::vector<float> dst;
+  std::vector<cvs::half> src_half;
+  std::vector<cvs::half> dst_half;
+
+  LinearFrames()
+      : src(size_t(kMaxSize) * 4),
+        dst(size_t(kMaxSize) * 4),
+        src_half(size_t(kMaxSize) * 4),
+        dst_half(size_t(kMaxSize) * 4) {
+    std::mt19937 mt(std::random_device{}());
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    for (size_t i = 0; i < src.size(); i++) {
+      src[i] = dist(mt);
+      src_half[i] = cvs::FloatToHalf(src[i]);
+    }
+  }
+};
+
+// The float and half frames take 480 MB, shared like Frames.
+class LinearFixture : public benchmark::Fixture {
+ public:
+  float* src = nullptr;
+  float* dst = nullptr;
+  cvs::half* src_half = nullptr;
+  cvs::half* dst_half = nullptr;
+
+  void SetUp(const benchmark::State&) override {
+    static LinearFrames frames;
+    src = frames.src.data();
+    dst = frames.dst.data();
+    src_half = frames.src_half.data();
+    dst_half = frames.dst_half.data();
   }
 };
 
@@ -82,6 +192,36 @@ BENCHMARK_DEFINE_F(MyFixture, DaltonLensVienot1999)(benchmark::State& st) {
 }
 BENCHMARK_REGISTER_F(MyFixture, DaltonLensVienot1999)->BM_RANGE;
 
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensMachado2009)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens::SimulateMachado2009(Deficiency::Protan, 1.f, src.data(),
+                                         dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensMachado2009)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensDaltonizeBrettel1997)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens::DaltonizeBrettel1997(Deficiency::Protan, 1.f, src.data(),
+                                          dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensDaltonizeBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensDaltonizeVienot1999)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens::DaltonizeVienot1999(Deficiency::Protan, 1.f, src.data(),
+                                         dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensDaltonizeVienot1999)->BM_RANGE;
+
+#ifdef CVS_HAS_OPENMP
 BENCHMARK_DEFINE_F(MyFixture, DaltonLensOMPBrettel1997)(benchmark::State& st) {
   int size = st.range(0);
   for (auto _ : st) {
@@ -100,6 +240,206 @@ BENCHMARK_DEFINE_F(MyFixture, DaltonLensOMPVienot1999)(benchmark::State& st) {
 }
 BENCHMARK_REGISTER_F(MyFixture, DaltonLensOMPVienot1999)->BM_RANGE;
 
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensOMPMachado2009)(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::SimulateMachado2009(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensOMPMachado2009)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensOMPDaltonizeBrettel1997)
+(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::DaltonizeBrettel1997(Deficiency::Protan, 1.f,
+                                              src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensOMPDaltonizeBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensOMPDaltonizeVienot1999)
+(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::DaltonizeVienot1999(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensOMPDaltonizeVienot1999)->BM_RANGE;
+#endif
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensParBrettel1997)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_par::SimulateBrettel1997(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensParBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensParVienot1999)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_par::SimulateVienot1999(Deficiency::Protan, 1.f, src.data(),
+                                            dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensParVienot1999)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensParMachado2009)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_par::SimulateMachado2009(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensParMachado2009)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensParDaltonizeBrettel1997)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_par::DaltonizeBrettel1997(Deficiency::Protan, 1.f,
+                                              src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensParDaltonizeBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(MyFixture, DaltonLensParDaltonizeVienot1999)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_par::DaltonizeVienot1999(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DaltonLensParDaltonizeVienot1999)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(VectorFixture, DaltonLensBrettel1997)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens::SimulateBrettel1997(Deficiency::Protan, 1.f, src.data(),
+                                         dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(VectorFixture, DaltonLensBrettel1997)->BM_RANGE;
+
+#ifdef CVS_HAS_OPENMP
+BENCHMARK_DEFINE_F(VectorFixture, DaltonLensOMPBrettel1997)
+(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::SimulateBrettel1997(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(VectorFixture, DaltonLensOMPBrettel1997)->BM_RANGE;
+#endif
+
+BENCHMARK_DEFINE_F(LinearFixture, DaltonLensBrettel1997)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens::SimulateBrettel1997(Deficiency::Protan, 1.f, src, dst,
+                                         size);
+  }
+}
+BENCHMARK_REGISTER_F(LinearFixture, DaltonLensBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(LinearFixture, DaltonLensHalfBrettel1997)
+(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens::SimulateBrettel1997(Deficiency::Protan, 1.f, src_half,
+                                         dst_half, size);
+  }
+}
+BENCHMARK_REGISTER_F(LinearFixture, DaltonLensHalfBrettel1997)->BM_RANGE;
+
+#ifdef CVS_HAS_OPENMP
+BENCHMARK_DEFINE_F(LinearFixture, DaltonLensOMPBrettel1997)
+(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::SimulateBrettel1997(Deficiency::Protan, 1.f, src,
+                                             dst, size);
+  }
+}
+BENCHMARK_REGISTER_F(LinearFixture, DaltonLensOMPBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(LinearFixture, DaltonLensOMPHalfBrettel1997)
+(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::SimulateBrettel1997(Deficiency::Protan, 1.f,
+                                             src_half, dst_half, size);
+  }
+}
+BENCHMARK_REGISTER_F(LinearFixture, DaltonLensOMPHalfBrettel1997)->BM_RANGE;
+#endif
+
+#ifdef CVS_HAS_OPENMP
+void dedup_omp_brettel1997(const BGRA* src, BGRA* dst, size_t len) {
+  cvs::dedup::Simulate(
+      [](const BGRA* s, BGRA* d, size_t l) {
+        cvs::daltonlens_omp::SimulateBrettel1997(Deficiency::Protan, 1.f, s, d,
+                                                 l);
+      },
+      src, dst, len);
+}
+
+BENCHMARK_DEFINE_F(MyFixture, DedupOMPBrettel1997)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    dedup_omp_brettel1997(src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, DedupOMPBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(PaletteFixture, DaltonLensOMPBrettel1997)
+(benchmark::State& st) {
+  int size = st.range(0);
+  for (auto _ : st) {
+    cvs::daltonlens_omp::SimulateBrettel1997(Deficiency::Protan, 1.f,
+                                             src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(PaletteFixture, DaltonLensOMPBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(PaletteFixture, DedupOMPBrettel1997)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    dedup_omp_brettel1997(src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(PaletteFixture, DedupOMPBrettel1997)->BM_RANGE;
+#endif
+
+// One pixel changes per frame, so a single tile is recomputed. The frame is
+// a private copy, as the shared source frame must stay unchanged for the
+// other benchmarks.
+BENCHMARK_DEFINE_F(MyFixture, IncrementalVienot1999)(benchmark::State& st) {
+  const int size = st.range(0);
+  const int width = std::min(size, 1000);
+  const int height = size / width;
+  cvs::FrameBuffer frame(size);
+  std::copy(src.begin(), src.begin() + size, frame.begin());
+  cvs::IncrementalSimulator sim(
+      width, height, [](const BGRA* s, BGRA* d, size_t len) {
+        cvs::daltonlens::SimulateVienot1999(Deficiency::Protan, 1.f, s, d, len);
+      });
+  sim.Process(frame.data());
+  for (auto _ : st) {
+    frame[0].r++;
+    benchmark::DoNotOptimize(sim.Process(frame.data()));
+  }
+}
+BENCHMARK_REGISTER_F(MyFixture, IncrementalVienot1999)->BM_RANGE;
+
+#ifdef CVS_HAS_OPENCL
 BENCHMARK_DEFINE_F(CLFixture, Brettel1997)(benchmark::State& st) {
   size_t size = st.range(0);
   for (auto _ : st) {
@@ -116,4 +456,45 @@ BENCHMARK_DEFINE_F(CLFixture, Vienot1999)(benchmark::State& st) {
 }
 BENCHMARK_REGISTER_F(CLFixture, Vienot1999)->BM_RANGE;
 
+// One simulator shared by several threads, each on its own part of the frame.
+BENCHMARK_DEFINE_F(CLFixture, Vienot1999Shared)(benchmark::State& st) {
+  size_t size = st.range(0);
+  const size_t offset = st.thread_index() * size;
+  for (auto _ : st) {
+    sim.Vienot1999(Deficiency::Protan, 1.f, src.data() + offset,
+                   dst.data() + offset, size);
+  }
+}
+BENCHMARK_REGISTER_F(CLFixture, Vienot1999Shared)
+    ->RangeMultiplier(10)
+    ->Range(10, kMaxSize / 10)
+    ->Threads(4);
+
+BENCHMARK_DEFINE_F(CLFixture, Machado2009)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    sim.Machado2009(Deficiency::Protan, 1.f, src.data(), dst.data(), size);
+  }
+}
+BENCHMARK_REGISTER_F(CLFixture, Machado2009)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(CLFixture, DaltonizeBrettel1997)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    sim.DaltonizeBrettel1997(Deficiency::Protan, 1.f, src.data(), dst.data(),
+                             size);
+  }
+}
+BENCHMARK_REGISTER_F(CLFixture, DaltonizeBrettel1997)->BM_RANGE;
+
+BENCHMARK_DEFINE_F(CLFixture, DaltonizeVienot1999)(benchmark::State& st) {
+  size_t size = st.range(0);
+  for (auto _ : st) {
+    sim.DaltonizeVienot1999(Deficiency::Protan, 1.f, src.data(), dst.data(),
+                            size);
+  }
+}
+BENCHMARK_REGISTER_F(CLFixture, DaltonizeVienot1999)->BM_RANGE;
+#endif
+
 BENCHMARK_MAIN();
@@ -0,0 +1,507 @@
+// Per-frame latency under concurrent load.
+//
+// cvs_bench reports the mean time of back-to-back calls on an otherwise idle
+// machine. Here several caller threads issue frames at a fixed arrival rate
+// (open loop) while other threads stream through memory, and every call is
+// recorded in a histogram, so that p99 and p99.9 can be read off.
+//
+// Latency is measured from the time a frame was due, not from the time the
+// call started: a frame that had to wait for the previous one to finish is
+// charged for the wait, as a real caller would be.
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cvs.h"
+#include "daltonlens.h"
+#ifdef CVS_HAS_OPENCL
+#include "daltonlens_cl.h"
+#endif
+#ifdef CVS_HAS_OPENMP
+#include "daltonlens_omp.h"
+#endif
+#include "daltonlens_par.h"
+#include "frame_buffer.h"
+
+using cvs::BGRA;
+using cvs::Deficiency;
+using Clock = std::chrono::steady_clock;
+
+// Log-linear histogram of nanoseconds, after HdrHistogram: values below
+// 2^kSubBits are exact, larger ones keep kSubBits significant bits, which
+// bounds the relative error of a percentile by 1 / 2^kSubBits.
+class Histogram {
+ public:
+  static constexpr int kSubBits = 7;
+  static constexpr uint64_t kSubCount = uint64_t(1) << kSubBits;
+
+  Histogram() : counts((64 - kSubBits + 1) * kSubCount) {}
+
+  void Record(uint64_t ns) {
+    counts[index(ns)]++;
+    total++;
+    sum += ns;
+    max = std::max(max, ns);
+  }
+
+  void Add(const Histogram& other) {
+    for (size_t i = 0; i < counts.size(); i++) counts[i] += other.counts[i];
+    total += other.total;
+    sum += other.sum;
+    max = std::max(max, other.max);
+  }
+
+  // Highest value that falls in the same bucket as the q-quantile.
+  uint64_t Percentile(double q) const {
+    if (total == 0) return 0;
+    const uint64_t rank =
+        std::max<uint64_t>(1, uint64_t(std::ceil(q * double(total))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+      seen += counts[i];
+      if (seen >= rank) return std::min(highest(i), max);
+    }
+    return max;
+  }
+
+  uint64_t Count() const { return total; }
+  uint64_t Max() const { return max; }
+  double Mean() const { return total ? double(sum) / total : 0; }
+
+ private:
+  static size_t index(uint64_t v) {
+    if (v < kSubCount) return v;
+    const int shift = std::bit_width(v) - 1 - kSubBits;
+    return (shift + 1) * kSubCount + ((v >> shift) - kSubCount);
+  }
+
+  static uint64_t highest(size_t i) {
+    if (i < kSubCount) return i;
+    const int shift = int(i / kSubCount) - 1;
+    const uint64_t low = (kSubCount + i % kSubCount) << shift;
+    return low + (uint64_t(1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+};
+
+struct SizeWeight {
+  size_t pixels;
+  double weight;
+};
+
+struct Options {
+  std::string impl = "daltonlens";
+  std::string method = "brettel1997";
+  std::vector<SizeWeight> sizes = { { 100'000, 6 },
+                                    { 1'000'000, 3 },
+                                    { 10'000'000, 1 } };
+  // Frames per second over all caller threads.
+  double rate = 50;
+  int threads = 4;
+  int noise_threads = 0;
+  size_t noise_bytes = size_t(256) << 20;
+  double duration = 10;
+  std::string json;
+};
+
+using Simulate = std::function<void(const BGRA* src, BGRA* dst, size_t len)>;
+
+// Returns a factory that each caller thread calls once for its simulator.
+std::optional<std::function<Simulate()>> select_simulator(const Options& opt) {
+  const auto& method = opt.method;
+  const auto d = Deficiency::Protan;
+  const float s = 1.f;
+  if (opt.impl == "daltonlens") {
+    Simulate f;
+    if (method == "brettel1997") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    } else if (method == "vienot1999") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateVienot1999(d, s, src, dst, len);
+      };
+    } else if (method == "machado2009") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateMachado2009(d, s, src, dst, len);
+      };
+    } else {
+      return std::nullopt;
+    }
+    return [f] { return f; };
+  }
+#ifdef CVS_HAS_OPENMP
+  if (opt.impl == "daltonlens_omp") {
+    Simulate f;
+    if (method == "brettel1997") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateBrettel1997(d, s, src, dst, int(len));
+      };
+    } else if (method == "vienot1999") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateVienot1999(d, s, src, dst, int(len));
+      };
+    } else if (method == "machado2009") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateMachado2009(d, s, src, dst, int(len));
+      };
+    } else {
+      return std::nullopt;
+    }
+    return [f] { return f; };
+  }
+#endif
+  if (opt.impl == "daltonlens_par") {
+    Simulate f;
+    if (method == "brettel1997") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    } else if (method == "vienot1999") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateVienot1999(d, s, src, dst, len);
+      };
+    } else if (method == "machado2009") {
+      f = [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateMachado2009(d, s, src, dst, len);
+      };
+    } else {
+      return std::nullopt;
+    }
+    return [f] { return f; };
+  }
+#ifdef CVS_HAS_OPENCL
+  if (opt.impl == "daltonlens_cl") {
+    if (method != "brettel1997" && method != "vienot1999" &&
+        method != "machado2009") {
+      return std::nullopt;
+    }
+    // One simulator for all caller threads, with a queue for each.
+    cl::Context context(CL_DEVICE_TYPE_DEFAULT);
+    auto sim = std::make_shared<cvs::daltonlens_cl::Simulator>(
+        context, size_t(opt.threads));
+    Simulate f = [=](const BGRA* src, BGRA* dst, size_t len) {
+      if (method == "brettel1997") {
+        sim->Brettel1997(d, s, src, dst, len);
+      } else if (method == "vienot1999") {
+        sim->Vienot1999(d, s, src, dst, len);
+      } else {
+        sim->Machado2009(d, s, src, dst, len);
+      }
+    };
+    return [f] { return f; };
+  }
+#endif
+  return std::nullopt;
+}
+
+// Background load: reads and writes a buffer much larger than the last level
+// cache, one cache line at a time, until `stop` is set.
+void memory_noise(size_t bytes, const std::atomic<bool>& stop) {
+  std::vector<uint64_t> buf(bytes / sizeof(uint64_t), 1);
+  constexpr size_t kStep = 64 / sizeof(uint64_t);
+  while (!stop.load(std::memory_order_relaxed)) {
+    for (size_t i = 0; i < buf.size(); i += kStep) buf[i] += buf[i] >> 1;
+  }
+}
+
+// Starts the clock once every worker has warmed up.
+struct StartClock {
+  Clock::time_point* start;
+
+  void operator()() noexcept {
+    *start = Clock::now() + std::chrono::milliseconds(10);
+  }
+};
+
+struct WorkerResult {
+  // latency[i] and service[i] are for opt.sizes[i].
+  std::vector<Histogram> latency;
+  std::vector<Histogram> service;
+  // Frames that started more than one arrival interval late.
+  uint64_t behind = 0;
+};
+
+void run_worker(const Options& opt, int index, const Simulate& simulate,
+                std::barrier<StartClock>& ready,
+                const Clock::time_point& start,
+                WorkerResult& result) {
+  size_t max_pixels = 0;
+  std::vector<double> weights;
+  for (const auto& sw : opt.sizes) {
+    max_pixels = std::max(max_pixels, sw.pixels);
+    weights.push_back(sw.weight);
+  }
+  cvs::FrameBuffer src(max_pixels);
+  cvs::FrameBuffer dst(max_pixels);
+  std::mt19937 mt(index);
+  for (auto& px : src) {
+    const uint32_t v = mt();
+    px = BGRA{ uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), 255 };
+  }
+  for (const auto& sw : opt.sizes) simulate(src.data(), dst.data(), sw.pixels);
+
+  result.latency.resize(opt.sizes.size());
+  result.service.resize(opt.sizes.size());
+  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+  ready.arrive_and_wait();
+
+  // Each thread takes every opt.threads-th arrival of the global schedule.
+  const std::chrono::duration<double> interval(opt.threads / opt.rate);
+  const auto end = start + std::chrono::duration<double>(opt.duration);
+  for (uint64_t k = 0;; k++) {
+    const auto due =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    interval * (double(k) + double(index) / opt.threads));
+    if (due >= end) break;
+    auto now = Clock::now();
+    if (now < due) {
+      std::this_thread::sleep_until(due);
+      now = Clock::now();
+    } else if (now - due > interval) {
+      result.behind++;
+    }
+
+    const size_t i = pick(mt);
+    simulate(src.data(), dst.data(), opt.sizes[i].pixels);
+    const auto done = Clock::now();
+    result.latency[i].Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(done - due)
+            .count());
+    result.service[i].Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(done - now)
+            .count());
+  }
+}
+
+std::string bench_name(const Options& opt) {
+  return "Latency/" + opt.impl + "/" + opt.method;
+}
+
+// Same layout as `cvs_bench --benchmark_format=json`, so plot/ can read it:
+// one entry per percentile and frame size, with the size last in the name and
+// the percentile in real_time. cpu_time holds the same percentile of the
+// service time, without the wait for a busy caller thread.
+void write_json(std::ostream& os, const Options& opt,
+                const std::vector<Histogram>& latency,
+                const std::vector<Histogram>& service) {
+  const std::time_t now = std::time(nullptr);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+                std::localtime(&now));
+
+  os << "{\n"
+     << "  \"context\": {\n"
+     << "    \"date\": \"" << date << "\",\n"
+     << "    \"executable\": \"cvs_latency\",\n"
+     << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+     << "    \"impl\": \"" << opt.impl << "\",\n"
+     << "    \"method\": \"" << opt.method << "\",\n"
+     << "    \"rate\": " << opt.rate << ",\n"
+     << "    \"threads\": " << opt.threads << ",\n"
+     << "    \"noise_threads\": " << opt.noise_threads << ",\n"
+     << "    \"duration\": " << opt.duration << "\n"
+     << "  },\n"
+     << "  \"benchmarks\": [" << std::fixed << std::setprecision(0);
+
+  const struct {
+    const char* label;
+    double q;
+  } percentiles[] = { { "p50", 0.5 }, { "p99", 0.99 }, { "p99.9", 0.999 } };
+  bool first = true;
+  for (const auto& p : percentiles) {
+    for (size_t i = 0; i < opt.sizes.size(); i++) {
+      if (latency[i].Count() == 0) continue;
+      const std::string name = bench_name(opt) + "/" + p.label + "/" +
+                               std::to_string(opt.sizes[i].pixels);
+      os << (first ? "\n" : ",\n") << "    {\n"
+         << "      \"name\": \"" << name << "\",\n"
+         << "      \"run_name\": \"" << name << "\",\n"
+         << "      \"run_type\": \"iteration\",\n"
+         << "      \"iterations\": " << latency[i].Count() << ",\n"
+         << "      \"real_time\": " << latency[i].Percentile(p.q) << ",\n"
+         << "      \"cpu_time\": " << service[i].Percentile(p.q) << ",\n"
+         << "      \"time_unit\": \"ns\",\n"
+         << "      \"mean\": " << latency[i].Mean() << ",\n"
+         << "      \"max\": " << latency[i].Max() << "\n"
+         << "    }";
+      first = false;
+    }
+  }
+  os << "\n  ]\n}\n";
+}
+
+void print_table(const Options& opt, const std::vector<Histogram>& latency,
+                 const std::vector<Histogram>& service, uint64_t behind) {
+  auto us = [](double ns) {
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(1) << ns / 1000;
+    return s.str();
+  };
+  std::cout << bench_name(opt) << ": " << opt.rate << " frames/s on "
+            << opt.threads << " threads, " << opt.noise_threads
+            << " noise threads\n";
+  std::cout << std::setw(10) << "pixels" << std::setw(9) << "frames"
+            << std::setw(11) << "p50 us" << std::setw(11) << "p99 us"
+            << std::setw(11) << "p99.9 us" << std::setw(11) << "max us"
+            << std::setw(13) << "service p99" << '\n';
+  for (size_t i = 0; i < opt.sizes.size(); i++) {
+    const auto& h = latency[i];
+    std::cout << std::setw(10) << opt.sizes[i].pixels << std::setw(9)
+              << h.Count() << std::setw(11) << us(h.Percentile(0.5))
+              << std::setw(11) << us(h.Percentile(0.99)) << std::setw(11)
+              << us(h.Percentile(0.999)) << std::setw(11) << us(h.Max())
+              << std::setw(13) << us(service[i].Percentile(0.99)) << '\n';
+  }
+  if (behind > 0) {
+    std::cout << behind
+              << " frames started more than one interval late; the rate is "
+                 "above what this backend sustains\n";
+  }
+  std::cout << std::flush;
+}
+
+void usage() {
+  std::cout
+      << "Usage: cvs_latency [options]\n"
+         "  --impl daltonlens|daltonlens_omp|daltonlens_par|daltonlens_cl\n"
+         "  --method brettel1997|vienot1999|machado2009\n"
+         "  --sizes <pixels>[:weight],...  (default: "
+         "100000:6,1000000:3,10000000:1)\n"
+         "  --rate <frames/s>              (default: 50, over all threads)\n"
+         "  --threads N                    (default: 4)\n"
+         "  --noise N --noise-mb <MiB>     (memory traffic threads)\n"
+         "  --duration <seconds>           (default: 10)\n"
+         "  --json <output.json>"
+      << std::endl;
+}
+
+std::optional<std::vector<SizeWeight>> parse_sizes(const std::string& value) {
+  std::vector<SizeWeight> sizes;
+  std::istringstream in(value);
+  std::string item;
+  while (std::getline(in, item, ',')) {
+    char* end = nullptr;
+    SizeWeight sw{ std::strtoull(item.c_str(), &end, 10), 1 };
+    if (*end == ':') sw.weight = std::strtod(end + 1, &end);
+    if (*end != '\0' || sw.pixels == 0 || sw.weight <= 0) return std::nullopt;
+    sizes.push_back(sw);
+  }
+  if (sizes.empty()) return std::nullopt;
+  return sizes;
+}
+
+std::optional<Options> parse_args(int argc, const char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) return std::nullopt;
+    const std::string value = argv[++i];
+    if (arg == "--impl") {
+      opt.impl = value;
+    } else if (arg == "--method") {
+      opt.method = value;
+    } else if (arg == "--sizes") {
+      auto sizes = parse_sizes(value);
+      if (!sizes) return std::nullopt;
+      opt.sizes = *sizes;
+    } else if (arg == "--rate") {
+      opt.rate = std::strtod(value.c_str(), nullptr);
+    } else if (arg == "--threads") {
+      opt.threads = std::atoi(value.c_str());
+    } else if (arg == "--noise") {
+      opt.noise_threads = std::atoi(value.c_str());
+    } else if (arg == "--noise-mb") {
+      opt.noise_bytes = size_t(std::atoi(value.c_str())) << 20;
+    } else if (arg == "--duration") {
+      opt.duration = std::strtod(value.c_str(), nullptr);
+    } else if (arg == "--json") {
+      opt.json = value;
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (opt.rate <= 0 || opt.threads <= 0 || opt.noise_threads < 0 ||
+      opt.duration <= 0) {
+    return std::nullopt;
+  }
+  return opt;
+}
+
+int main(int argc, const char* argv[]) {
+  const auto opt = parse_args(argc, argv);
+  if (!opt) {
+    usage();
+    return 1;
+  }
+  const auto make_simulator = select_simulator(*opt);
+  if (!make_simulator) {
+    std::cerr << "unknown impl/method: " << opt->impl << "/" << opt->method
+              << std::endl;
+    return 1;
+  }
+
+  std::atomic<bool> stop_noise{ false };
+  std::vector<std::thread> noise;
+  for (int i = 0; i < opt->noise_threads; i++) {
+    noise.emplace_back(memory_noise, opt->noise_bytes, std::cref(stop_noise));
+  }
+
+  Clock::time_point start;
+  std::barrier ready(opt->threads, StartClock{ &start });
+  std::vector<WorkerResult> results(opt->threads);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < opt->threads; i++) {
+    workers.emplace_back([&, i] {
+      const Simulate simulate = (*make_simulator)();
+      run_worker(*opt, i, simulate, ready, start, results[i]);
+    });
+  }
+  for (auto& t : workers) t.join();
+  stop_noise = true;
+  for (auto& t : noise) t.join();
+
+  std::vector<Histogram> latency(opt->sizes.size());
+  std::vector<Histogram> service(opt->sizes.size());
+  uint64_t behind = 0;
+  for (const auto& r : results) {
+    for (size_t i = 0; i < opt->sizes.size(); i++) {
+      latency[i].Add(r.latency[i]);
+      service[i].Add(r.service[i]);
+    }
+    behind += r.behind;
+  }
+
+  print_table(*opt, latency, service, behind);
+  if (!opt->json.empty()) {
+    std::ofstream out(opt->json);
+    write_json(out, *opt, latency, service);
+    if (!out) {
+      std::cerr << "cannot write " << opt->json << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #ifndef CL_KERNEL_SOURCE
@@ -15,6 +16,11 @@ struct BGRA {
   uint8_t a;
 };
 
+// IEEE 754 binary16, kept as raw bits. See half.h for conversions.
+struct half {
+  uint16_t bits;
+};
+
 enum class Deficiency {
   Protan,
   Deutan,
@@ -2,6 +2,12 @@
 
 #include <cmath>
 
+#include "half.h"
+#include "machado2009.h"
+
+using cvs::BGRA;
+using cvs::Deficiency;
+
 static float linearRGB_from_sRGB(uint8_t v) {
   float fv = v / 255.f;
   if (fv < 0.04045f) return fv / 12.92f;
@@ -61,22 +67,20 @@ static Brettel1997Params brettel_tritan_params = {
   .normal = { 0.03901, -0.02788, -0.01113 },
 };
 
-void cvs::daltonlens::SimulateBrettel1997(Deficiency deficiency, float severity,
-                                          const BGRA *src, BGRA *dst,
-                                          size_t len) {
-  const Brettel1997Params *params = nullptr;
+static const Brettel1997Params *brettel_params(Deficiency deficiency) {
   switch (deficiency) {
     case Deficiency::Protan:
-      params = &brettel_protan_params;
-      break;
+      return &brettel_protan_params;
     case Deficiency::Deutan:
-      params = &brettel_deutan_params;
-      break;
+      return &brettel_deutan_params;
     case Deficiency::Tritan:
-      params = &brettel_tritan_params;
-      break;
+      return &brettel_tritan_params;
   }
+  return nullptr;
+}
 
+static void brettel1997(const Brettel1997Params *params, float severity,
+                        const BGRA *src, BGRA *dst, size_t len) {
   for (size_t i = 0; i < len; i++) {
     const float rgb[3] = {
       linearRGB_from_sRGB(src[i].r),
@@ -105,6 +109,12 @@ void cvs::daltonlens::SimulateBrettel1997(Deficiency deficiency, float severity,
   }
 }
 
+void cvs::daltonlens::SimulateBrettel1997(Deficiency deficiency, float severity,
+                                          const BGRA *src, BGRA *dst,
+                                          size_t len) {
+  brettel1997(brettel_params(deficiency), severity, src, dst, len);
+}
+
 static float vienot_protan_mat[] = {
   0.11238,  0.88762, 0.00000,  0.11238, 0.88762,
   -0.00000, 0.00401, -0.00401, 1.00000,
@@ -120,21 +130,20 @@ static float vienot_tritan_mat[] = {
   0.14076, -0.00000, 0.85924,  0.14076,
 };
 
-void cvs::daltonlens::SimulateVienot1999(Deficiency deficiency, float severity,
-                                         const BGRA *src, BGRA *dst,
-                                         size_t len) {
-  const float *mat = nullptr;
+static const float *vienot_mat(Deficiency deficiency) {
   switch (deficiency) {
     case Deficiency::Protan:
-      mat = vienot_protan_mat;
-      break;
+      return vienot_protan_mat;
     case Deficiency::Deutan:
-      mat = vienot_deutan_mat;
-      break;
+      return vienot_deutan_mat;
     case Deficiency::Tritan:
-      mat = vienot_tritan_mat;
-      break;
+      return vienot_tritan_mat;
   }
+  return nullptr;
+}
+
+static void vienot1999(const float *mat, float severity, const BGRA *src,
+                       BGRA *dst, size_t len) {
   for (size_t i = 0; i < len; i++) {
     const float rgb[3] = {
       linearRGB_from_sRGB(src[i].r),
@@ -158,3 +167,220 @@ void cvs::daltonlens::SimulateVienot1999(Deficiency deficiency, float severity,
     dst[i].a = src[i].a;
   }
 }
+
+void cvs::daltonlens::SimulateVienot1999(Deficiency deficiency, float severity,
+                                         const BGRA *src, BGRA *dst,
+                                         size_t len) {
+  vienot1999(vienot_mat(deficiency), severity, src, dst, len);
+}
+
+// Machado2009 is a plain matrix like Vienot1999, with the severity already
+// interpolated into it.
+void cvs::daltonlens::SimulateMachado2009(Deficiency deficiency, float severity,
+                                          const BGRA *src, BGRA *dst,
+                                          size_t len) {
+  float mat[9];
+  machado2009::Matrix(deficiency, severity, mat);
+  vienot1999(mat, 1.f, src, dst, len);
+}
+
+// Fidaner et al.: the part of the colour the simulated observer loses is
+// shifted onto the channels they can still tell apart.
+static float daltonize_protan_mat[] = {
+  0.0, 0.0, 0.0,
+  0.7, 1.0, 0.0,
+  0.7, 0.0, 1.0,
+};
+
+static float daltonize_deutan_mat[] = {
+  1.0, 0.7, 0.0,
+  0.0, 0.0, 0.0,
+  0.0, 0.7, 1.0,
+};
+
+static float daltonize_tritan_mat[] = {
+  1.0, 0.0, 0.7,
+  0.0, 1.0, 0.7,
+  0.0, 0.0, 0.0,
+};
+
+static const float *daltonize_mat(Deficiency deficiency) {
+  switch (deficiency) {
+    case Deficiency::Protan:
+      return daltonize_protan_mat;
+    case Deficiency::Deutan:
+      return daltonize_deutan_mat;
+    case Deficiency::Tritan:
+      return daltonize_tritan_mat;
+  }
+  return nullptr;
+}
+
+// Simulation with severity s, error and correction are all linear in
+// linearRGB, so daltonizing is a single matrix:
+//   sim = s * S + (1 - s) * I
+//   out = rgb + E * (rgb - sim * rgb) = (I + s * E * (I - S)) * rgb
+static void fuse_daltonize(const float *sim, float severity, const float *err,
+                           float *out) {
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      float v = 0.f;
+      for (int k = 0; k < 3; k++) {
+        const float diff = (k == c ? 1.f : 0.f) - sim[k * 3 + c];
+        v += err[r * 3 + k] * diff;
+      }
+      out[r * 3 + c] = (r == c ? 1.f : 0.f) + severity * v;
+    }
+  }
+}
+
+void cvs::daltonlens::DaltonizeBrettel1997(Deficiency deficiency,
+                                           float severity, const BGRA *src,
+                                           BGRA *dst, size_t len) {
+  const Brettel1997Params *sim = brettel_params(deficiency);
+  const float *err = daltonize_mat(deficiency);
+
+  // The half-plane test still uses the original colour, so each of the two
+  // Brettel matrices is fused separately.
+  Brettel1997Params params;
+  fuse_daltonize(sim->mat1, severity, err, params.mat1);
+  fuse_daltonize(sim->mat2, severity, err, params.mat2);
+  for (int i = 0; i < 3; i++) params.normal[i] = sim->normal[i];
+
+  brettel1997(&params, 1.f, src, dst, len);
+}
+
+void cvs::daltonlens::DaltonizeVienot1999(Deficiency deficiency, float severity,
+                                          const BGRA *src, BGRA *dst,
+                                          size_t len) {
+  float mat[9];
+  fuse_daltonize(vienot_mat(deficiency), severity, daltonize_mat(deficiency),
+                 mat);
+  vienot1999(mat, 1.f, src, dst, len);
+}
+
+// Linear-light paths. Channels are r, g, b[, a]; alpha is copied, or set to 1
+// when only the output has it.
+static void load(const float *p, int n, float *v) {
+  for (int k = 0; k < n; k++) v[k] = p[k];
+}
+
+static void store(const float *v, int n, float *p) {
+  for (int k = 0; k < n; k++) p[k] = v[k];
+}
+
+static void brettel1997_linear(const Brettel1997Params *params, float severity,
+                               const float *src, float *dst, size_t len,
+                               size_t src_stride, size_t dst_stride) {
+  const int src_n = src_stride >= 4 ? 4 : 3;
+  const int dst_n = dst_stride >= 4 ? 4 : 3;
+  for (size_t i = 0; i < len; i++) {
+    float rgb[4] = { 0.f, 0.f, 0.f, 1.f };
+    load(src + i * src_stride, src_n, rgb);
+
+    const float *n = params->normal;
+    const float dot = rgb[0] * n[0] + rgb[1] * n[1] + rgb[2] * n[2];
+    const float *mat = dot >= 0 ? params->mat1 : params->mat2;
+
+    float rgb_cvd[4] = {
+      mat[0] * rgb[0] + mat[1] * rgb[1] + mat[2] * rgb[2],
+      mat[3] * rgb[0] + mat[4] * rgb[1] + mat[5] * rgb[2],
+      mat[6] * rgb[0] + mat[7] * rgb[1] + mat[8] * rgb[2],
+      rgb[3],
+    };
+
+    rgb_cvd[0] = rgb_cvd[0] * severity + rgb[0] * (1.f - severity);
+    rgb_cvd[1] = rgb_cvd[1] * severity + rgb[1] * (1.f - severity);
+    rgb_cvd[2] = rgb_cvd[2] * severity + rgb[2] * (1.f - severity);
+
+    store(rgb_cvd, dst_n, dst + i * dst_stride);
+  }
+}
+
+static void vienot1999_linear(const float *mat, float severity,
+                              const float *src, float *dst, size_t len,
+                              size_t src_stride,
+                              size_t dst_stride) {
+  const int src_n = src_stride >= 4 ? 4 : 3;
+  const int dst_n = dst_stride >= 4 ? 4 : 3;
+  for (size_t i = 0; i < len; i++) {
+    float rgb[4] = { 0.f, 0.f, 0.f, 1.f };
+    load(src + i * src_stride, src_n, rgb);
+
+    float rgb_cvd[4] = {
+      mat[0] * rgb[0] + mat[1] * rgb[1] + mat[2] * rgb[2],
+      mat[3] * rgb[0] + mat[4] * rgb[1] + mat[5] * rgb[2],
+      mat[6] * rgb[0] + mat[7] * rgb[1] + mat[8] * rgb[2],
+      rgb[3],
+    };
+
+    rgb_cvd[0] = rgb_cvd[0] * severity + rgb[0] * (1.f - severity);
+    rgb_cvd[1] = rgb_cvd[1] * severity + rgb[1] * (1.f - severity);
+    rgb_cvd[2] = rgb_cvd[2] * severity + rgb[2] * (1.f - severity);
+
+    store(rgb_cvd, dst_n, dst + i * dst_stride);
+  }
+}
+
+
+void cvs::daltonlens::SimulateBrettel1997(Deficiency deficiency, float severity,
+                                          const float *src, float *dst,
+                                          size_t len, size_t src_stride,
+                                          size_t dst_stride) {
+  brettel1997_linear(brettel_params(deficiency), severity, src, dst, len,
+                     src_stride, dst_stride);
+}
+
+void cvs::daltonlens::SimulateVienot1999(Deficiency deficiency, float severity,
+                                         const float *src, float *dst,
+                                         size_t len, size_t src_stride,
+                                         size_t dst_stride) {
+  vienot1999_linear(vienot_mat(deficiency), severity, src, dst, len, src_stride,
+                    dst_stride);
+}
+
+void cvs::daltonlens::SimulateMachado2009(Deficiency deficiency, float severity,
+                                          const float *src, float *dst,
+                                          size_t len, size_t src_stride,
+                                          size_t dst_stride) {
+  float mat[9];
+  machado2009::Matrix(deficiency, severity, mat);
+  vienot1999_linear(mat, 1.f, src, dst, len, src_stride, dst_stride);
+}
+
+
+void cvs::daltonlens::SimulateBrettel1997(Deficiency deficiency, float severity,
+                                          const half *src, half *dst,
+                                          size_t len, size_t src_stride,
+                                          size_t dst_stride) {
+  const auto *params = brettel_params(deficiency);
+  cvs::RunOnFloat(
+      [&](const float *s, float *d, size_t n, size_t ss, size_t ds) {
+        brettel1997_linear(params, severity, s, d, n, ss, ds);
+      },
+      src, dst, 0, len, src_stride, dst_stride);
+}
+
+void cvs::daltonlens::SimulateVienot1999(Deficiency deficiency, float severity,
+                                         const half *src, half *dst, size_t len,
+                                         size_t src_stride, size_t dst_stride) {
+  const float *mat = vienot_mat(deficiency);
+  cvs::RunOnFloat(
+      [&](const float *s, float *d, size_t n, size_t ss, size_t ds) {
+        vienot1999_linear(mat, severity, s, d, n, ss, ds);
+      },
+      src, dst, 0, len, src_stride, dst_stride);
+}
+
+void cvs::daltonlens::SimulateMachado2009(Deficiency deficiency, float severity,
+                                          const half *src, half *dst,
+                                          size_t len, size_t src_stride,
+                                          size_t dst_stride) {
+  float mat[9];
+  machado2009::Matrix(deficiency, severity, mat);
+  cvs::RunOnFloat(
+      [&](const float *s, float *d, size_t n, size_t ss, size_t ds) {
+        vienot1999_linear(mat, 1.f, s, d, n, ss, ds);
+      },
+      src, dst, 0, len, src_stride, dst_stride);
+}
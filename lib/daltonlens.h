@@ -12,4 +12,44 @@ void SimulateBrettel1997(Deficiency deficiency, float severity, const BGRA *src,
 void SimulateVienot1999(Deficiency deficiency, float severity, const BGRA *src,
                         BGRA *dst, size_t len);
 
+void SimulateMachado2009(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, size_t len);
+
+// Simulates the deficiency and adds the lost part of the colour back onto the
+// channels that remain distinguishable, in a single pass.
+void DaltonizeBrettel1997(Deficiency deficiency, float severity,
+                          const BGRA *src, BGRA *dst, size_t len);
+
+void DaltonizeVienot1999(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, size_t len);
+
+// Linear-light entry points for pipelines that already work in linearRGB.
+// They skip the sRGB transfer functions and do not clamp the output. Pixels
+// are r, g, b[, a] with `src_stride` / `dst_stride` elements from one pixel to
+// the next: 3 for RGB, 4 for RGBA, more for padded layouts. Alpha is copied
+// when both layouts have it, and set to 1 when only the output has it.
+void SimulateBrettel1997(Deficiency deficiency, float severity,
+                         const float *src, float *dst, size_t len,
+                         size_t src_stride = 4, size_t dst_stride = 4);
+
+void SimulateVienot1999(Deficiency deficiency, float severity, const float *src,
+                        float *dst, size_t len, size_t src_stride = 4,
+                        size_t dst_stride = 4);
+
+void SimulateMachado2009(Deficiency deficiency, float severity,
+                         const float *src, float *dst, size_t len,
+                         size_t src_stride = 4, size_t dst_stride = 4);
+
+void SimulateBrettel1997(Deficiency deficiency, float severity, const half *src,
+                         half *dst, size_t len, size_t src_stride = 4,
+                         size_t dst_stride = 4);
+
+void SimulateVienot1999(Deficiency deficiency, float severity, const half *src,
+                        half *dst, size_t len, size_t src_stride = 4,
+                        size_t dst_stride = 4);
+
+void SimulateMachado2009(Deficiency deficiency, float severity, const half *src,
+                         half *dst, size_t len, size_t src_stride = 4,
+                         size_t dst_stride = 4);
+
 };  // namespace cvs::daltonlens
@@ -1,5 +1,13 @@
 #include "daltonlens_cl.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#include "machado2009.h"
+
 struct Brettel1997Params {
   float mat1[9];
   float mat2[9];
@@ -46,42 +54,147 @@ static Brettel1997Params brettel_tritan_params = {
   .normal = { -0.01113, -0.02788, 0.03901 },
 };
 
-void cvs::daltonlens_cl::Simulator::Brettel1997(Deficiency deficiency,
-                                                float severity, const BGRA* src,
-                                                BGRA* dst, size_t len) {
-  const Brettel1997Params* params = nullptr;
+static const Brettel1997Params* brettel_params(cvs::Deficiency deficiency) {
   switch (deficiency) {
-    case Deficiency::Protan:
-      params = &brettel_protan_params;
-      break;
-    case Deficiency::Deutan:
-      params = &brettel_deutan_params;
-      break;
-    case Deficiency::Tritan:
-      params = &brettel_tritan_params;
-      break;
+    case cvs::Deficiency::Protan:
+      return &brettel_protan_params;
+    case cvs::Deficiency::Deutan:
+      return &brettel_deutan_params;
+    case cvs::Deficiency::Tritan:
+      return &brettel_tritan_params;
+  }
+  return nullptr;
+}
+
+// One caller's command queue and kernels. Kernel arguments are per kernel
+// object, so they cannot be shared between concurrent calls.
+struct cvs::daltonlens_cl::Simulator::Worker {
+  std::atomic_flag busy;
+  cl::CommandQueue queue;
+
+  cl::Kernel brettel1997;
+  cl::Kernel vienot1999;
+  cl::Kernel brettel1997_linear;
+  cl::Kernel vienot1999_linear;
+  cl::Kernel brettel1997_half;
+  cl::Kernel vienot1999_half;
+
+  Worker(const cl::Context& context, const cl::Program& program)
+      : queue(context),
+        brettel1997(program, "Brettel1997"),
+        vienot1999(program, "Vienot1999"),
+        brettel1997_linear(program, "Brettel1997Linear"),
+        vienot1999_linear(program, "Vienot1999Linear"),
+        brettel1997_half(program, "Brettel1997LinearHalf"),
+        vienot1999_half(program, "Vienot1999LinearHalf") {}
+};
+
+// Holds a worker for the duration of one call.
+class cvs::daltonlens_cl::Simulator::Lease {
+ public:
+  explicit Lease(std::vector<std::unique_ptr<Worker>>& workers) {
+    // Each thread starts looking at its own worker, so a thread mostly gets
+    // the same one back and threads rarely contend for a flag.
+    thread_local const size_t home =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+    const size_t n = workers.size();
+    for (;;) {
+      for (size_t i = 0; i < n; i++) {
+        Worker& w = *workers[(home + i) % n];
+        if (!w.busy.test(std::memory_order_relaxed) &&
+            !w.busy.test_and_set(std::memory_order_acquire)) {
+          worker = &w;
+          return;
+        }
+      }
+      // All busy: sleep until the home worker is released, then look again.
+      workers[home % n]->busy.wait(true, std::memory_order_relaxed);
+    }
+  }
+
+  ~Lease() {
+    worker->busy.clear(std::memory_order_release);
+    worker->busy.notify_all();
+  }
+
+  Lease(const Lease&) = delete;
+  Lease& operator=(const Lease&) = delete;
+
+  Worker* operator->() const { return worker; }
+
+ private:
+  Worker* worker;
+};
+
+cvs::daltonlens_cl::Simulator::Simulator(const cl::Context& context,
+                                         size_t workers)
+    : context(context), program(context, kernel_source, true) {
+  for (size_t i = 0; i < std::max<size_t>(workers, 1); i++) {
+    this->workers.push_back(std::make_unique<Worker>(context, program));
   }
+}
+
+cvs::daltonlens_cl::Simulator::~Simulator() = default;
+
+static bool page_aligned(const void* p) {
+  return reinterpret_cast<uintptr_t>(p) % 4096 == 0;
+}
+
+// Runs one of the per-pixel kernels, whose arguments are all
+// (src, dst, params, severity).
+static void run(cl::Context& context, cl::CommandQueue& queue,
+                cl::Kernel& kernel, const void* params, size_t params_size,
+                float severity, const cvs::BGRA* src, cvs::BGRA* dst,
+                size_t len) {
+  // OpenCL has no zero-size buffers.
+  if (len == 0) return;
 
-  cl::Buffer buf_src(context, CL_MEM_READ_ONLY, len * sizeof(cvs::BGRA));
-  cl::Buffer buf_dst(context, CL_MEM_WRITE_ONLY, len * sizeof(cvs::BGRA));
-  cl::Buffer buf_params(context, CL_MEM_READ_ONLY, sizeof(Brettel1997Params));
+  const size_t size = len * sizeof(cvs::BGRA);
+  cl::Buffer buf_params(context, CL_MEM_READ_ONLY, params_size);
+  queue.enqueueWriteBuffer(buf_params, CL_TRUE, 0, params_size, params);
 
-  queue.enqueueWriteBuffer(buf_src, CL_TRUE, 0, sizeof(cvs::BGRA) * len, src);
-  // queue.enqueueWriteBuffer(buf_dst, CL_TRUE, 0, sizeof(cvs::BGRA) * len,
-  // dst);
-  queue.enqueueWriteBuffer(buf_params, CL_TRUE, 0, sizeof(Brettel1997Params),
-                           params);
+  // Page-aligned frames, such as large FrameBuffers, are used in place, which
+  // saves both copies on devices that share memory with the host.
+  const bool in_place = page_aligned(src) && page_aligned(dst);
+  cl::Buffer buf_src;
+  cl::Buffer buf_dst;
+  if (in_place) {
+    buf_src = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, size,
+                         const_cast<cvs::BGRA*>(src));
+    buf_dst =
+        cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, size, dst);
+  } else {
+    buf_src = cl::Buffer(context, CL_MEM_READ_ONLY, size);
+    buf_dst = cl::Buffer(context, CL_MEM_WRITE_ONLY, size);
+    queue.enqueueWriteBuffer(buf_src, CL_TRUE, 0, size, src);
+  }
 
-  brettel1997.setArg(0, buf_src);
-  brettel1997.setArg(1, buf_dst);
-  brettel1997.setArg(2, buf_params);
-  brettel1997.setArg(3, severity);
+  kernel.setArg(0, buf_src);
+  kernel.setArg(1, buf_dst);
+  kernel.setArg(2, buf_params);
+  kernel.setArg(3, severity);
 
-  queue.enqueueNDRangeKernel(brettel1997, cl::NullRange, cl::NDRange(len));
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(len));
 
   queue.finish();
 
-  queue.enqueueReadBuffer(buf_dst, CL_TRUE, 0, sizeof(cvs::BGRA) * len, dst);
+  if (in_place) {
+    // Mapping is what makes the results visible in dst.
+    void* mapped =
+        queue.enqueueMapBuffer(buf_dst, CL_TRUE, CL_MAP_READ, 0, size);
+    queue.enqueueUnmapMemObject(buf_dst, mapped);
+    queue.finish();
+  } else {
+    queue.enqueueReadBuffer(buf_dst, CL_TRUE, 0, size, dst);
+  }
+}
+
+void cvs::daltonlens_cl::Simulator::Brettel1997(Deficiency deficiency,
+                                                float severity, const BGRA* src,
+                                                BGRA* dst, size_t len) {
+  Lease w(workers);
+  run(context, w->queue, w->brettel1997, brettel_params(deficiency),
+      sizeof(Brettel1997Params), severity, src, dst, len);
 }
 
 static float vienot_protan_mat[3][3] = {
@@ -102,37 +215,226 @@ static float vienot_tritan_mat[3][3] = {
   { -0.14461, 0.14461, 1.00000 },
 };
 
+static const float* vienot_mat(cvs::Deficiency deficiency) {
+  switch (deficiency) {
+    case cvs::Deficiency::Protan:
+      return (float*)vienot_protan_mat;
+    case cvs::Deficiency::Deutan:
+      return (float*)vienot_deutan_mat;
+    case cvs::Deficiency::Tritan:
+      return (float*)vienot_tritan_mat;
+  }
+  return nullptr;
+}
+
 void cvs::daltonlens_cl::Simulator::Vienot1999(Deficiency deficiency,
                                                float severity, const BGRA* src,
                                                BGRA* dst, size_t len) {
-  const float* mat = nullptr;
+  Lease w(workers);
+  run(context, w->queue, w->vienot1999, vienot_mat(deficiency),
+      sizeof(vienot_protan_mat), severity, src, dst, len);
+}
+
+static void machado_mat(cvs::Deficiency deficiency, float severity,
+                        float* mat) {
+  float rgb[9];
+  cvs::machado2009::Matrix(deficiency, severity, rgb);
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      mat[r * 3 + c] = rgb[(2 - r) * 3 + (2 - c)];
+    }
+  }
+}
+
+// Runs on the Vienot1999 kernel with the matrix reordered to BGR.
+void cvs::daltonlens_cl::Simulator::Machado2009(Deficiency deficiency,
+                                                float severity, const BGRA* src,
+                                                BGRA* dst, size_t len) {
+  float mat[9];
+  machado_mat(deficiency, severity, mat);
+  Lease w(workers);
+  run(context, w->queue, w->vienot1999, mat, sizeof(mat), 1.f, src, dst, len);
+}
+
+// Same redistribution as the CPU backends, in BGR order.
+static float daltonize_protan_mat[3][3] = {
+  { 1.0, 0.0, 0.7 },
+  { 0.0, 1.0, 0.7 },
+  { 0.0, 0.0, 0.0 },
+};
+
+static float daltonize_deutan_mat[3][3] = {
+  { 1.0, 0.7, 0.0 },
+  { 0.0, 0.0, 0.0 },
+  { 0.0, 0.7, 1.0 },
+};
+
+static float daltonize_tritan_mat[3][3] = {
+  { 0.0, 0.0, 0.0 },
+  { 0.7, 1.0, 0.0 },
+  { 0.7, 0.0, 1.0 },
+};
+
+static const float* daltonize_mat(cvs::Deficiency deficiency) {
   switch (deficiency) {
-    case Deficiency::Protan:
-      mat = (float*)vienot_protan_mat;
-      break;
-    case Deficiency::Deutan:
-      mat = (float*)vienot_deutan_mat;
-      break;
-    case Deficiency::Tritan:
-      mat = (float*)vienot_tritan_mat;
-      break;
+    case cvs::Deficiency::Protan:
+      return (float*)daltonize_protan_mat;
+    case cvs::Deficiency::Deutan:
+      return (float*)daltonize_deutan_mat;
+    case cvs::Deficiency::Tritan:
+      return (float*)daltonize_tritan_mat;
   }
+  return nullptr;
+}
+
+// I + s * E * (I - S), see daltonlens.cpp.
+static void fuse_daltonize(const float* sim, float severity, const float* err,
+                           float* out) {
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      float v = 0.f;
+      for (int k = 0; k < 3; k++) {
+        const float diff = (k == c ? 1.f : 0.f) - sim[k * 3 + c];
+        v += err[r * 3 + k] * diff;
+      }
+      out[r * 3 + c] = (r == c ? 1.f : 0.f) + severity * v;
+    }
+  }
+}
 
-  cl::Buffer buf_src(context, CL_MEM_READ_ONLY, len * sizeof(cvs::BGRA));
-  cl::Buffer buf_dst(context, CL_MEM_WRITE_ONLY, len * sizeof(cvs::BGRA));
-  cl::Buffer buf_mat(context, CL_MEM_READ_ONLY, sizeof(vienot_protan_mat));
+void cvs::daltonlens_cl::Simulator::DaltonizeBrettel1997(Deficiency deficiency,
+                                                         float severity,
+                                                         const BGRA* src,
+                                                         BGRA* dst,
+                                                         size_t len) {
+  const Brettel1997Params* sim = brettel_params(deficiency);
+  const float* err = daltonize_mat(deficiency);
 
-  queue.enqueueWriteBuffer(buf_src, CL_TRUE, 0, sizeof(cvs::BGRA) * len, src);
-  queue.enqueueWriteBuffer(buf_mat, CL_TRUE, 0, sizeof(vienot_protan_mat), mat);
+  Brettel1997Params params;
+  fuse_daltonize(sim->mat1, severity, err, params.mat1);
+  fuse_daltonize(sim->mat2, severity, err, params.mat2);
+  for (int i = 0; i < 3; i++) params.normal[i] = sim->normal[i];
 
-  vienot1999.setArg(0, buf_src);
-  vienot1999.setArg(1, buf_dst);
-  vienot1999.setArg(2, buf_mat);
-  vienot1999.setArg(3, severity);
+  Lease w(workers);
+  run(context, w->queue, w->brettel1997, &params, sizeof(params), 1.f, src, dst,
+      len);
+}
+
+void cvs::daltonlens_cl::Simulator::DaltonizeVienot1999(Deficiency deficiency,
+                                                        float severity,
+                                                        const BGRA* src,
+                                                        BGRA* dst, size_t len) {
+  float mat[9];
+  fuse_daltonize(vienot_mat(deficiency), severity, daltonize_mat(deficiency),
+                 mat);
+  Lease w(workers);
+  run(context, w->queue, w->vienot1999, mat, sizeof(mat), 1.f, src, dst, len);
+}
 
-  queue.enqueueNDRangeKernel(vienot1999, cl::NullRange, cl::NDRange(len));
+// Runs one of the linear kernels, whose arguments are all
+// (src, dst, params, severity, src_stride, dst_stride).
+template <typename T>
+static void run_linear(cl::Context& context, cl::CommandQueue& queue,
+                       cl::Kernel& kernel, const void* params,
+                       size_t params_size, float severity, const T* src,
+                       T* dst, size_t len, size_t src_stride,
+                       size_t dst_stride) {
+  if (len == 0) return;
+
+  // The last pixel only needs its own channels, not the padding after it.
+  const size_t src_size =
+      ((len - 1) * src_stride + std::min<size_t>(src_stride, 4)) * sizeof(T);
+  const size_t dst_size =
+      ((len - 1) * dst_stride + std::min<size_t>(dst_stride, 4)) * sizeof(T);
+  cl::Buffer buf_src(context, CL_MEM_READ_ONLY, src_size);
+  cl::Buffer buf_dst(context, CL_MEM_READ_WRITE, dst_size);
+  cl::Buffer buf_params(context, CL_MEM_READ_ONLY, params_size);
+
+  queue.enqueueWriteBuffer(buf_src, CL_TRUE, 0, src_size, src);
+  queue.enqueueWriteBuffer(buf_params, CL_TRUE, 0, params_size, params);
+  // Padding channels are read back with the pixels, so keep the caller's.
+  if (dst_stride > 4) {
+    queue.enqueueWriteBuffer(buf_dst, CL_TRUE, 0, dst_size, dst);
+  }
+
+  kernel.setArg(0, buf_src);
+  kernel.setArg(1, buf_dst);
+  kernel.setArg(2, buf_params);
+  kernel.setArg(3, severity);
+  kernel.setArg(4, cl_uint(src_stride));
+  kernel.setArg(5, cl_uint(dst_stride));
+
+  queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(len));
 
   queue.finish();
 
-  queue.enqueueReadBuffer(buf_dst, CL_TRUE, 0, sizeof(cvs::BGRA) * len, dst);
+  queue.enqueueReadBuffer(buf_dst, CL_TRUE, 0, dst_size, dst);
+}
+
+void cvs::daltonlens_cl::Simulator::Brettel1997(Deficiency deficiency,
+                                                float severity,
+                                                const float* src, float* dst,
+                                                size_t len, size_t src_stride,
+                                                size_t dst_stride) {
+  Lease w(workers);
+  run_linear(context, w->queue, w->brettel1997_linear,
+             brettel_params(deficiency), sizeof(Brettel1997Params), severity,
+             src, dst, len, src_stride, dst_stride);
+}
+
+void cvs::daltonlens_cl::Simulator::Vienot1999(Deficiency deficiency,
+                                               float severity, const float* src,
+                                               float* dst, size_t len,
+                                               size_t src_stride,
+                                               size_t dst_stride) {
+  Lease w(workers);
+  run_linear(context, w->queue, w->vienot1999_linear, vienot_mat(deficiency),
+             sizeof(vienot_protan_mat), severity, src, dst, len, src_stride,
+             dst_stride);
+}
+
+void cvs::daltonlens_cl::Simulator::Machado2009(Deficiency deficiency,
+                                                float severity,
+                                                const float* src, float* dst,
+                                                size_t len, size_t src_stride,
+                                                size_t dst_stride) {
+  float mat[9];
+  machado_mat(deficiency, severity, mat);
+  Lease w(workers);
+  run_linear(context, w->queue, w->vienot1999_linear, mat, sizeof(mat), 1.f,
+             src, dst, len, src_stride, dst_stride);
+}
+
+void cvs::daltonlens_cl::Simulator::Brettel1997(Deficiency deficiency,
+                                                float severity, const half* src,
+                                                half* dst, size_t len,
+                                                size_t src_stride,
+                                                size_t dst_stride) {
+  Lease w(workers);
+  run_linear(context, w->queue, w->brettel1997_half, brettel_params(deficiency),
+             sizeof(Brettel1997Params), severity, src, dst, len, src_stride,
+             dst_stride);
+}
+
+void cvs::daltonlens_cl::Simulator::Vienot1999(Deficiency deficiency,
+                                               float severity, const half* src,
+                                               half* dst, size_t len,
+                                               size_t src_stride,
+                                               size_t dst_stride) {
+  Lease w(workers);
+  run_linear(context, w->queue, w->vienot1999_half, vienot_mat(deficiency),
+             sizeof(vienot_protan_mat), severity, src, dst, len, src_stride,
+             dst_stride);
+}
+
+void cvs::daltonlens_cl::Simulator::Machado2009(Deficiency deficiency,
+                                                float severity, const half* src,
+                                                half* dst, size_t len,
+                                                size_t src_stride,
+                                                size_t dst_stride) {
+  float mat[9];
+  machado_mat(deficiency, severity, mat);
+  Lease w(workers);
+  run_linear(context, w->queue, w->vienot1999_half, mat, sizeof(mat), 1.f,
+             src, dst, len, src_stride, dst_stride);
 }
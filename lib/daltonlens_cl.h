@@ -1,7 +1,9 @@
 #pragma once
 
 #include <CL/cl.hpp>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "cvs.h"
 
@@ -11,26 +13,61 @@ const std::string kernel_source =
 #include "kernel.cl"
     ;
 
+// Safe to share between threads. The program is built once; every call
+// checks out one of `workers` sets of command queue and kernels without
+// locking, so up to that many calls run on the device at once and further
+// ones wait for a free set.
 class Simulator {
  public:
-  Simulator(cl::Context& context, cl::CommandQueue& queue)
-      : context(context), queue(queue), program(context, kernel_source, true) {
-    brettel1997 = cl::Kernel(program, "Brettel1997");
-    vienot1999 = cl::Kernel(program, "Vienot1999");
-  }
+  explicit Simulator(const cl::Context& context, size_t workers = 4);
+  ~Simulator();
+
+  Simulator(const Simulator&) = delete;
+  Simulator& operator=(const Simulator&) = delete;
 
   void Brettel1997(Deficiency deficiency, float severity, const BGRA* src,
                    BGRA* dst, size_t len);
   void Vienot1999(Deficiency deficiency, float severity, const BGRA* src,
                   BGRA* dst, size_t len);
 
+  void Machado2009(Deficiency deficiency, float severity, const BGRA* src,
+                   BGRA* dst, size_t len);
+
+  // Daltonization reuses the simulation kernels with the simulation and the
+  // error correction fused into their matrices.
+  void DaltonizeBrettel1997(Deficiency deficiency, float severity,
+                            const BGRA* src, BGRA* dst, size_t len);
+  void DaltonizeVienot1999(Deficiency deficiency, float severity,
+                           const BGRA* src, BGRA* dst, size_t len);
+
+  // Linear-light pixels with strides, see daltonlens.h.
+  void Brettel1997(Deficiency deficiency, float severity, const float* src,
+                   float* dst, size_t len, size_t src_stride = 4,
+                   size_t dst_stride = 4);
+  void Vienot1999(Deficiency deficiency, float severity, const float* src,
+                  float* dst, size_t len, size_t src_stride = 4,
+                  size_t dst_stride = 4);
+  void Machado2009(Deficiency deficiency, float severity, const float* src,
+                   float* dst, size_t len, size_t src_stride = 4,
+                   size_t dst_stride = 4);
+
+  void Brettel1997(Deficiency deficiency, float severity, const half* src,
+                   half* dst, size_t len, size_t src_stride = 4,
+                   size_t dst_stride = 4);
+  void Vienot1999(Deficiency deficiency, float severity, const half* src,
+                  half* dst, size_t len, size_t src_stride = 4,
+                  size_t dst_stride = 4);
+  void Machado2009(Deficiency deficiency, float severity, const half* src,
+                   half* dst, size_t len, size_t src_stride = 4,
+                   size_t dst_stride = 4);
+
  private:
-  cl::Context& context;
-  cl::CommandQueue& queue;
-  cl::Program program;
+  struct Worker;
+  class Lease;
 
-  cl::Kernel brettel1997;
-  cl::Kernel vienot1999;
+  cl::Context context;
+  cl::Program program;
+  std::vector<std::unique_ptr<Worker>> workers;
 };
 
 };  // namespace cvs::daltonlens_cl
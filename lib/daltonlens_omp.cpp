@@ -4,6 +4,13 @@
 
 #include <cmath>
 
+#include "daltonlens.h"
+#include "half.h"
+#include "machado2009.h"
+
+using cvs::BGRA;
+using cvs::Deficiency;
+
 static float linearRGB_from_sRGB(uint8_t v) {
   float fv = v / 255.f;
   if (fv < 0.04045f) return fv / 12.92f;
@@ -63,22 +70,20 @@ static Brettel1997Params brettel_tritan_params = {
   .normal = { 0.03901, -0.02788, -0.01113 },
 };
 
-void cvs::daltonlens_omp::SimulateBrettel1997(Deficiency deficiency,
-                                              float severity, const BGRA *src,
-                                              BGRA *dst, int len) {
-  const Brettel1997Params *params = nullptr;
+static const Brettel1997Params *brettel_params(Deficiency deficiency) {
   switch (deficiency) {
     case Deficiency::Protan:
-      params = &brettel_protan_params;
-      break;
+      return &brettel_protan_params;
     case Deficiency::Deutan:
-      params = &brettel_deutan_params;
-      break;
+      return &brettel_deutan_params;
     case Deficiency::Tritan:
-      params = &brettel_tritan_params;
-      break;
+      return &brettel_tritan_params;
   }
+  return nullptr;
+}
 
+static void brettel1997(const Brettel1997Params *params, float severity,
+                        const BGRA *src, BGRA *dst, int len) {
 #pragma omp parallel for
   for (int i = 0; i < len; i++) {
     const float rgb[3] = {
@@ -108,6 +113,12 @@ void cvs::daltonlens_omp::SimulateBrettel1997(Deficiency deficiency,
   }
 }
 
+void cvs::daltonlens_omp::SimulateBrettel1997(Deficiency deficiency,
+                                              float severity, const BGRA *src,
+                                              BGRA *dst, int len) {
+  brettel1997(brettel_params(deficiency), severity, src, dst, len);
+}
+
 static float vienot_protan_mat[] = {
   0.11238,  0.88762, 0.00000,  0.11238, 0.88762,
   -0.00000, 0.00401, -0.00401, 1.00000,
@@ -123,22 +134,20 @@ static float vienot_tritan_mat[] = {
   0.14076, -0.00000, 0.85924,  0.14076,
 };
 
-void cvs::daltonlens_omp::SimulateVienot1999(Deficiency deficiency,
-                                             float severity, const BGRA *src,
-                                             BGRA *dst, int len) {
-  const float *mat = nullptr;
+static const float *vienot_mat(Deficiency deficiency) {
   switch (deficiency) {
     case Deficiency::Protan:
-      mat = vienot_protan_mat;
-      break;
+      return vienot_protan_mat;
     case Deficiency::Deutan:
-      mat = vienot_deutan_mat;
-      break;
+      return vienot_deutan_mat;
     case Deficiency::Tritan:
-      mat = vienot_tritan_mat;
-      break;
+      return vienot_tritan_mat;
   }
+  return nullptr;
+}
 
+static void vienot1999(const float *mat, float severity, const BGRA *src,
+                       BGRA *dst, int len) {
 #pragma omp parallel for
   for (int i = 0; i < len; i++) {
     const float rgb[3] = {
@@ -163,3 +172,233 @@ void cvs::daltonlens_omp::SimulateVienot1999(Deficiency deficiency,
     dst[i].a = src[i].a;
   }
 }
+
+void cvs::daltonlens_omp::SimulateVienot1999(Deficiency deficiency,
+                                             float severity, const BGRA *src,
+                                             BGRA *dst, int len) {
+  vienot1999(vienot_mat(deficiency), severity, src, dst, len);
+}
+
+void cvs::daltonlens_omp::SimulateMachado2009(Deficiency deficiency,
+                                              float severity, const BGRA *src,
+                                              BGRA *dst, int len) {
+  float mat[9];
+  machado2009::Matrix(deficiency, severity, mat);
+  vienot1999(mat, 1.f, src, dst, len);
+}
+
+static float daltonize_protan_mat[] = {
+  0.0, 0.0, 0.0,
+  0.7, 1.0, 0.0,
+  0.7, 0.0, 1.0,
+};
+
+static float daltonize_deutan_mat[] = {
+  1.0, 0.7, 0.0,
+  0.0, 0.0, 0.0,
+  0.0, 0.7, 1.0,
+};
+
+static float daltonize_tritan_mat[] = {
+  1.0, 0.0, 0.7,
+  0.0, 1.0, 0.7,
+  0.0, 0.0, 0.0,
+};
+
+static const float *daltonize_mat(Deficiency deficiency) {
+  switch (deficiency) {
+    case Deficiency::Protan:
+      return daltonize_protan_mat;
+    case Deficiency::Deutan:
+      return daltonize_deutan_mat;
+    case Deficiency::Tritan:
+      return daltonize_tritan_mat;
+  }
+  return nullptr;
+}
+
+// I + s * E * (I - S), see daltonlens.cpp.
+static void fuse_daltonize(const float *sim, float severity, const float *err,
+                           float *out) {
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      float v = 0.f;
+      for (int k = 0; k < 3; k++) {
+        const float diff = (k == c ? 1.f : 0.f) - sim[k * 3 + c];
+        v += err[r * 3 + k] * diff;
+      }
+      out[r * 3 + c] = (r == c ? 1.f : 0.f) + severity * v;
+    }
+  }
+}
+
+void cvs::daltonlens_omp::DaltonizeBrettel1997(Deficiency deficiency,
+                                               float severity, const BGRA *src,
+                                               BGRA *dst, int len) {
+  const Brettel1997Params *sim = brettel_params(deficiency);
+  const float *err = daltonize_mat(deficiency);
+
+  Brettel1997Params params;
+  fuse_daltonize(sim->mat1, severity, err, params.mat1);
+  fuse_daltonize(sim->mat2, severity, err, params.mat2);
+  for (int i = 0; i < 3; i++) params.normal[i] = sim->normal[i];
+
+  brettel1997(&params, 1.f, src, dst, len);
+}
+
+void cvs::daltonlens_omp::DaltonizeVienot1999(Deficiency deficiency,
+                                              float severity, const BGRA *src,
+                                              BGRA *dst, int len) {
+  float mat[9];
+  fuse_daltonize(vienot_mat(deficiency), severity, daltonize_mat(deficiency),
+                 mat);
+  vienot1999(mat, 1.f, src, dst, len);
+}
+
+// Linear-light paths. Channels are r, g, b[, a]; alpha is copied, or set to 1
+// when only the output has it.
+static void load(const float *p, int n, float *v) {
+  for (int k = 0; k < n; k++) v[k] = p[k];
+}
+
+static void store(const float *v, int n, float *p) {
+  for (int k = 0; k < n; k++) p[k] = v[k];
+}
+
+static void brettel1997_linear(const Brettel1997Params *params, float severity,
+                               const float *src, float *dst, int len,
+                               size_t src_stride, size_t dst_stride) {
+  const int src_n = src_stride >= 4 ? 4 : 3;
+  const int dst_n = dst_stride >= 4 ? 4 : 3;
+#pragma omp parallel for
+  for (int i = 0; i < len; i++) {
+    float rgb[4] = { 0.f, 0.f, 0.f, 1.f };
+    load(src + i * src_stride, src_n, rgb);
+
+    const float *n = params->normal;
+    const float dot = rgb[0] * n[0] + rgb[1] * n[1] + rgb[2] * n[2];
+    const float *mat = dot >= 0 ? params->mat1 : params->mat2;
+
+    float rgb_cvd[4] = {
+      mat[0] * rgb[0] + mat[1] * rgb[1] + mat[2] * rgb[2],
+      mat[3] * rgb[0] + mat[4] * rgb[1] + mat[5] * rgb[2],
+      mat[6] * rgb[0] + mat[7] * rgb[1] + mat[8] * rgb[2],
+      rgb[3],
+    };
+
+    rgb_cvd[0] = rgb_cvd[0] * severity + rgb[0] * (1.f - severity);
+    rgb_cvd[1] = rgb_cvd[1] * severity + rgb[1] * (1.f - severity);
+    rgb_cvd[2] = rgb_cvd[2] * severity + rgb[2] * (1.f - severity);
+
+    store(rgb_cvd, dst_n, dst + i * dst_stride);
+  }
+}
+
+static void vienot1999_linear(const float *mat, float severity,
+                              const float *src, float *dst, int len,
+                              size_t src_stride,
+                              size_t dst_stride) {
+  const int src_n = src_stride >= 4 ? 4 : 3;
+  const int dst_n = dst_stride >= 4 ? 4 : 3;
+#pragma omp parallel for
+  for (int i = 0; i < len; i++) {
+    float rgb[4] = { 0.f, 0.f, 0.f, 1.f };
+    load(src + i * src_stride, src_n, rgb);
+
+    float rgb_cvd[4] = {
+      mat[0] * rgb[0] + mat[1] * rgb[1] + mat[2] * rgb[2],
+      mat[3] * rgb[0] + mat[4] * rgb[1] + mat[5] * rgb[2],
+      mat[6] * rgb[0] + mat[7] * rgb[1] + mat[8] * rgb[2],
+      rgb[3],
+    };
+
+    rgb_cvd[0] = rgb_cvd[0] * severity + rgb[0] * (1.f - severity);
+    rgb_cvd[1] = rgb_cvd[1] * severity + rgb[1] * (1.f - severity);
+    rgb_cvd[2] = rgb_cvd[2] * severity + rgb[2] * (1.f - severity);
+
+    store(rgb_cvd, dst_n, dst + i * dst_stride);
+  }
+}
+
+
+void cvs::daltonlens_omp::SimulateBrettel1997(Deficiency deficiency,
+                                              float severity, const float *src,
+                                              float *dst, int len,
+                                              size_t src_stride,
+                                              size_t dst_stride) {
+  brettel1997_linear(brettel_params(deficiency), severity, src, dst, len,
+                     src_stride, dst_stride);
+}
+
+void cvs::daltonlens_omp::SimulateVienot1999(Deficiency deficiency,
+                                             float severity, const float *src,
+                                             float *dst, int len,
+                                             size_t src_stride,
+                                             size_t dst_stride) {
+  vienot1999_linear(vienot_mat(deficiency), severity, src, dst, len, src_stride,
+                    dst_stride);
+}
+
+void cvs::daltonlens_omp::SimulateMachado2009(Deficiency deficiency,
+                                              float severity, const float *src,
+                                              float *dst, int len,
+                                              size_t src_stride,
+                                              size_t dst_stride) {
+  float mat[9];
+  machado2009::Matrix(deficiency, severity, mat);
+  vienot1999_linear(mat, 1.f, src, dst, len, src_stride, dst_stride);
+}
+
+// Each thread converts and simulates its own contiguous share of a half frame
+// with the single-threaded float kernel.
+static void run_on_float(const cvs::FloatKernel &kernel, const cvs::half *src,
+                         cvs::half *dst, int len, size_t src_stride,
+                         size_t dst_stride) {
+#pragma omp parallel
+  {
+    const size_t t = omp_get_thread_num();
+    const size_t threads = omp_get_num_threads();
+    cvs::RunOnFloat(kernel, src, dst, len * t / threads,
+                    len * (t + 1) / threads, src_stride, dst_stride);
+  }
+}
+
+
+void cvs::daltonlens_omp::SimulateBrettel1997(Deficiency deficiency,
+                                              float severity, const half *src,
+                                              half *dst, int len,
+                                              size_t src_stride,
+                                              size_t dst_stride) {
+  run_on_float(
+      [&](const float *s, float *d, size_t n, size_t ss, size_t ds) {
+        cvs::daltonlens::SimulateBrettel1997(deficiency, severity, s, d, n, ss,
+                                             ds);
+      },
+      src, dst, len, src_stride, dst_stride);
+}
+
+void cvs::daltonlens_omp::SimulateVienot1999(Deficiency deficiency,
+                                             float severity, const half *src,
+                                             half *dst, int len,
+                                             size_t src_stride,
+                                             size_t dst_stride) {
+  run_on_float(
+      [&](const float *s, float *d, size_t n, size_t ss, size_t ds) {
+        cvs::daltonlens::SimulateVienot1999(deficiency, severity, s, d, n, ss,
+                                            ds);
+      },
+      src, dst, len, src_stride, dst_stride);
+}
+
+void cvs::daltonlens_omp::SimulateMachado2009(Deficiency deficiency,
+                                              float severity, const half *src,
+                                              half *dst, int len,
+                                              size_t src_stride,
+                                              size_t dst_stride) {
+  run_on_float(
+      [&](const float *s, float *d, size_t n, size_t ss, size_t ds) {
+        cvs::daltonlens::SimulateMachado2009(deficiency, severity, s, d, n, ss,
+                                             ds);
+      },
+      src, dst, len, src_stride, dst_stride);
+}
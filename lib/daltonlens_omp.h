@@ -12,4 +12,38 @@ void SimulateBrettel1997(Deficiency deficiency, float severity, const BGRA *src,
 void SimulateVienot1999(Deficiency deficiency, float severity, const BGRA *src,
                         BGRA *dst, int len);
 
+void SimulateMachado2009(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, int len);
+
+void DaltonizeBrettel1997(Deficiency deficiency, float severity,
+                          const BGRA *src, BGRA *dst, int len);
+
+void DaltonizeVienot1999(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, int len);
+
+// Linear-light entry points, see daltonlens.h.
+void SimulateBrettel1997(Deficiency deficiency, float severity,
+                         const float *src, float *dst, int len,
+                         size_t src_stride = 4, size_t dst_stride = 4);
+
+void SimulateVienot1999(Deficiency deficiency, float severity, const float *src,
+                        float *dst, int len, size_t src_stride = 4,
+                        size_t dst_stride = 4);
+
+void SimulateMachado2009(Deficiency deficiency, float severity,
+                         const float *src, float *dst, int len,
+                         size_t src_stride = 4, size_t dst_stride = 4);
+
+void SimulateBrettel1997(Deficiency deficiency, float severity, const half *src,
+                         half *dst, int len, size_t src_stride = 4,
+                         size_t dst_stride = 4);
+
+void SimulateVienot1999(Deficiency deficiency, float severity, const half *src,
+                        half *dst, int len, size_t src_stride = 4,
+                        size_t dst_stride = 4);
+
+void SimulateMachado2009(Deficiency deficiency, float severity, const half *src,
+                         half *dst, int len, size_t src_stride = 4,
+                         size_t dst_stride = 4);
+
 };  // namespace cvs::daltonlens_omp
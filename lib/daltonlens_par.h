@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cvs.h"
+
+// Backend on the C++17 parallel algorithms, for toolchains without OpenMP. It
+// only uses several cores where the standard library runs the algorithms in
+// parallel: libstdc++ needs TBB for that (CVS_HAS_TBB) and runs them
+// sequentially otherwise, MSVC has its own thread pool.
+namespace cvs::daltonlens_par {
+
+void SimulateBrettel1997(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, size_t len);
+
+void SimulateVienot1999(Deficiency deficiency, float severity, const BGRA *src,
+                        BGRA *dst, size_t len);
+
+void SimulateMachado2009(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, size_t len);
+
+void DaltonizeBrettel1997(Deficiency deficiency, float severity,
+                          const BGRA *src, BGRA *dst, size_t len);
+
+void DaltonizeVienot1999(Deficiency deficiency, float severity, const BGRA *src,
+                         BGRA *dst, size_t len);
+
+};  // namespace cvs::daltonlens_par
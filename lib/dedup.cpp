@@ -0,0 +1,200 @@
+#include "dedup.h"
+
+#include <memory>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using cvs::BGRA;
+
+namespace {
+
+constexpr uint32_t kEmpty = 0xFFFFFFFF;
+
+inline uint32_t color_key(const BGRA &px) {
+  return uint32_t(px.b) | uint32_t(px.g) << 8 | uint32_t(px.r) << 16;
+}
+
+// Open-addressing set of 24-bit colours with linear probing. kEmpty can never
+// be a key because the top byte of a key is always zero.
+class ColorTable {
+ public:
+  explicit ColorTable(size_t limit) : limit(limit) {
+    size_t slots = 16;
+    while (slots < limit * 2) slots <<= 1;
+    mask = slots - 1;
+    keys.assign(slots, kEmpty);
+  }
+
+  // Returns the slot of `key`, inserting it if needed, or -1 when `key` is new
+  // and the table already holds `limit` colours.
+  ptrdiff_t Insert(uint32_t key) {
+    size_t i = hash(key);
+    while (keys[i] != kEmpty) {
+      if (keys[i] == key) return i;
+      i = (i + 1) & mask;
+    }
+    if (count == limit) return -1;
+    keys[i] = key;
+    count++;
+    return i;
+  }
+
+  // `key` must be in the table.
+  size_t Find(uint32_t key) const {
+    size_t i = hash(key);
+    while (keys[i] != key) i = (i + 1) & mask;
+    return i;
+  }
+
+  size_t count = 0;
+  std::vector<uint32_t> keys;
+  // Per-slot payload, sized by the owner when needed.
+  std::vector<uint32_t> values;
+
+ private:
+  size_t hash(uint32_t key) const { return (key * 0x9E3779B1u >> 7) & mask; }
+
+  size_t limit;
+  size_t mask;
+};
+
+int max_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// [begin, end) of the calling thread's share of `len` pixels.
+void thread_range(size_t len, size_t &begin, size_t &end) {
+#ifdef _OPENMP
+  const size_t t = omp_get_thread_num();
+  const size_t nt = omp_get_num_threads();
+#else
+  const size_t t = 0;
+  const size_t nt = 1;
+#endif
+  begin = len * t / nt;
+  end = len * (t + 1) / nt;
+}
+
+// Cheap estimate of the palette size from evenly spaced pixels.
+bool worth_deduplicating(const BGRA *src, size_t len,
+                         const cvs::dedup::Options &opt) {
+  if (opt.sample_size == 0 || len < opt.sample_size * 2) return false;
+
+  ColorTable sample(opt.sample_size);
+  const size_t step = len / opt.sample_size;
+  for (size_t i = 0; i < opt.sample_size; i++) {
+    sample.Insert(color_key(src[i * step]));
+  }
+  return sample.count <= opt.sample_size * opt.max_sample_ratio;
+}
+
+}  // namespace
+
+void cvs::dedup::Simulate(const SimulateFunc &simulate, const BGRA *src,
+                          BGRA *dst, size_t len, const Options &opt,
+                          Stats *stats) {
+  if (stats) *stats = Stats{};
+
+  if (!worth_deduplicating(src, len, opt)) {
+    simulate(src, dst, len);
+    return;
+  }
+
+  // Every thread collects the colours of its own share without locking.
+  std::vector<std::unique_ptr<ColorTable>> locals(max_threads());
+  bool overflow = false;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    size_t begin, end;
+    thread_range(len, begin, end);
+#ifdef _OPENMP
+    auto &table = locals[omp_get_thread_num()];
+#else
+    auto &table = locals[0];
+#endif
+    table = std::make_unique<ColorTable>(opt.max_unique);
+
+    // Flat areas repeat the same colour, skip the probe for runs.
+    uint32_t last = kEmpty;
+    for (size_t i = begin; i < end; i++) {
+      const uint32_t key = color_key(src[i]);
+      if (key == last) continue;
+      last = key;
+      if (table->Insert(key) < 0) {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+        overflow = true;
+        break;
+      }
+    }
+  }
+
+  // Merge into one table whose values index the unique colour list.
+  ColorTable global(opt.max_unique);
+  global.values.resize(global.keys.size());
+  std::vector<BGRA> unique;
+  for (const auto &table : locals) {
+    if (!table || overflow) continue;
+    for (const uint32_t key : table->keys) {
+      if (key == kEmpty) continue;
+      const size_t before = global.count;
+      const ptrdiff_t slot = global.Insert(key);
+      if (slot < 0) {
+        overflow = true;
+        break;
+      }
+      if (global.count != before) {
+        global.values[slot] = unique.size();
+        unique.push_back(BGRA{
+          uint8_t(key),
+          uint8_t(key >> 8),
+          uint8_t(key >> 16),
+          255,
+        });
+      }
+    }
+  }
+  locals.clear();
+
+  if (overflow) {
+    simulate(src, dst, len);
+    return;
+  }
+
+  std::vector<BGRA> simulated(unique.size());
+  simulate(unique.data(), simulated.data(), unique.size());
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    size_t begin, end;
+    thread_range(len, begin, end);
+
+    uint32_t last = kEmpty;
+    BGRA out{};
+    for (size_t i = begin; i < end; i++) {
+      const uint32_t key = color_key(src[i]);
+      if (key != last) {
+        last = key;
+        out = simulated[global.values[global.Find(key)]];
+      }
+      dst[i] = BGRA{ out.b, out.g, out.r, src[i].a };
+    }
+  }
+
+  if (stats) {
+    stats->deduplicated = true;
+    stats->unique = unique.size();
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "cvs.h"
+
+// Simulates only the distinct colours of an image and scatters the results
+// back, for screenshots and charts with a small palette.
+namespace cvs::dedup {
+
+using SimulateFunc =
+    std::function<void(const BGRA *src, BGRA *dst, size_t len)>;
+
+struct Options {
+  // Number of evenly spaced pixels looked at before deciding on a path.
+  size_t sample_size = 16384;
+  // Take the direct path when more than this fraction of the sample is
+  // distinct.
+  float max_sample_ratio = 0.5f;
+  // Give up on deduplication once the image has more distinct colours.
+  size_t max_unique = 1 << 16;
+};
+
+struct Stats {
+  bool deduplicated = false;
+  size_t unique = 0;
+};
+
+// Produces the same output as calling `simulate` on the whole image. Alpha is
+// passed through per pixel, colours are keyed on 24-bit RGB.
+void Simulate(const SimulateFunc &simulate, const BGRA *src, BGRA *dst,
+              size_t len, const Options &opt = {}, Stats *stats = nullptr);
+
+};  // namespace cvs::dedup
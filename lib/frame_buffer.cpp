@@ -0,0 +1,153 @@
+#include "frame_buffer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#ifdef __linux__
+#define CVS_FRAME_MMAP
+#include <sys/mman.h>
+#endif
+
+using cvs::BGRA;
+
+namespace {
+
+constexpr size_t kHugePageSize = 2 << 20;
+
+size_t round_up(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+void *aligned_malloc(size_t bytes, size_t align) {
+#ifdef _WIN32
+  return _aligned_malloc(bytes, align);
+#else
+  return std::aligned_alloc(align, bytes);
+#endif
+}
+
+void aligned_free(void *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+// Pages are placed on first write, so this is what decides NUMA placement.
+void zero(BGRA *pixels, size_t len, bool first_touch) {
+  if (!first_touch) {
+    std::memset(pixels, 0, len * sizeof(BGRA));
+    return;
+  }
+  const ptrdiff_t n = len;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (ptrdiff_t i = 0; i < n; i++) {
+    pixels[i] = BGRA{ 0, 0, 0, 0 };
+  }
+}
+
+}  // namespace
+
+cvs::FrameBuffer::FrameBuffer(size_t len, const FrameBufferOptions &opt)
+    : len(len) {
+  if (len == 0) return;
+
+  const size_t raw = len * sizeof(BGRA);
+  if (opt.huge_pages != HugePages::None && raw >= kHugePageSize) {
+    bytes = round_up(raw, kHugePageSize);
+#ifdef CVS_FRAME_MMAP
+    if (opt.huge_pages == HugePages::Explicit) {
+      void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED) {
+        pixels = static_cast<BGRA *>(p);
+        mapped = true;
+        huge = true;
+      }
+    }
+#endif
+    if (!pixels) {
+      // Huge page alignment lets the kernel use huge pages from the first
+      // byte. The advice has to come before the pages are touched.
+      pixels = static_cast<BGRA *>(aligned_malloc(bytes, kHugePageSize));
+#if defined(CVS_FRAME_MMAP) && defined(MADV_HUGEPAGE)
+      huge = pixels && madvise(pixels, bytes, MADV_HUGEPAGE) == 0;
+#endif
+    }
+  } else {
+    bytes = round_up(raw, kFrameAlignment);
+    pixels = static_cast<BGRA *>(aligned_malloc(bytes, kFrameAlignment));
+  }
+  if (!pixels) throw std::bad_alloc();
+
+  zero(pixels, len, opt.first_touch);
+}
+
+cvs::FrameBuffer::~FrameBuffer() { release(); }
+
+cvs::FrameBuffer::FrameBuffer(FrameBuffer &&other) noexcept
+    : pixels(std::exchange(other.pixels, nullptr)),
+      len(std::exchange(other.len, 0)),
+      bytes(std::exchange(other.bytes, 0)),
+      mapped(std::exchange(other.mapped, false)),
+      huge(std::exchange(other.huge, false)) {}
+
+cvs::FrameBuffer &cvs::FrameBuffer::operator=(FrameBuffer &&other) noexcept {
+  if (this != &other) {
+    release();
+    pixels = std::exchange(other.pixels, nullptr);
+    len = std::exchange(other.len, 0);
+    bytes = std::exchange(other.bytes, 0);
+    mapped = std::exchange(other.mapped, false);
+    huge = std::exchange(other.huge, false);
+  }
+  return *this;
+}
+
+void cvs::FrameBuffer::release() {
+  if (!pixels) return;
+#ifdef CVS_FRAME_MMAP
+  if (mapped) {
+    munmap(pixels, bytes);
+    pixels = nullptr;
+    return;
+  }
+#endif
+  aligned_free(pixels);
+  pixels = nullptr;
+}
+
+cvs::FrameBuffer cvs::FramePool::Acquire(size_t len) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = free.begin(); it != free.end(); ++it) {
+      if (it->size() == len) {
+        FrameBuffer frame = std::move(*it);
+        free.erase(it);
+        return frame;
+      }
+    }
+  }
+  return FrameBuffer(len, opt);
+}
+
+void cvs::FramePool::Release(FrameBuffer &&frame) {
+  // Declared before the lock so that a frame the pool has no room for is
+  // freed after the lock is released.
+  FrameBuffer owned = std::move(frame);
+  FrameBuffer evicted;
+  if (owned.size() == 0 || max_free == 0) return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (free.size() >= max_free) {
+    // Evict the oldest frame rather than the incoming one, so that a pool
+    // full of an old size makes room when the frame size changes.
+    evicted = std::move(free.front());
+    free.erase(free.begin());
+  }
+  free.push_back(std::move(owned));
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "cvs.h"
+
+namespace cvs {
+
+// Alignment of every FrameBuffer, one cache line, so a frame never shares a
+// line with other data.
+constexpr size_t kFrameAlignment = 64;
+
+// Whether `p` has the alignment that FrameBuffer guarantees.
+inline bool IsFrameAligned(const void *p) {
+  return reinterpret_cast<uintptr_t>(p) % kFrameAlignment == 0;
+}
+
+enum class HugePages {
+  None,
+  // Ask the kernel to back the frame with transparent huge pages.
+  Transparent,
+  // Take pages from the hugetlbfs pool (vm.nr_hugepages), falling back to
+  // Transparent when the pool is empty.
+  Explicit,
+};
+
+struct FrameBufferOptions {
+  HugePages huge_pages = HugePages::Transparent;
+  // Zero the frame from all OpenMP threads with the same static schedule as
+  // the OpenMP backend, so each page lands on the NUMA node of the thread that
+  // will process it. Without OpenMP the calling thread zeroes it.
+  bool first_touch = true;
+};
+
+// Zero-initialised pixel storage aligned to kFrameAlignment. Frames of at
+// least one huge page are aligned to the huge page size and backed by huge
+// pages when available, which keeps TLB misses down on 40 MB frames.
+class FrameBuffer {
+ public:
+  FrameBuffer() = default;
+  explicit FrameBuffer(size_t len, const FrameBufferOptions &opt = {});
+  ~FrameBuffer();
+
+  FrameBuffer(FrameBuffer &&other) noexcept;
+  FrameBuffer &operator=(FrameBuffer &&other) noexcept;
+  FrameBuffer(const FrameBuffer &) = delete;
+  FrameBuffer &operator=(const FrameBuffer &) = delete;
+
+  BGRA *data() { return pixels; }
+  const BGRA *data() const { return pixels; }
+  size_t size() const { return len; }
+
+  BGRA *begin() { return pixels; }
+  BGRA *end() { return pixels + len; }
+  const BGRA *begin() const { return pixels; }
+  const BGRA *end() const { return pixels + len; }
+
+  BGRA &operator[](size_t i) { return pixels[i]; }
+  const BGRA &operator[](size_t i) const { return pixels[i]; }
+
+  // Whether the frame came from the hugetlbfs pool or was advised for
+  // transparent huge pages.
+  bool huge_pages() const { return huge; }
+
+ private:
+  void release();
+
+  BGRA *pixels = nullptr;
+  size_t len = 0;
+  size_t bytes = 0;
+  bool mapped = false;
+  bool huge = false;
+};
+
+// Recycles frames of the same size, e.g. between the stages of a pipeline,
+// so that steady-state processing does not allocate or fault in pages.
+class FramePool {
+ public:
+  explicit FramePool(const FrameBufferOptions &opt = {}, size_t max_free = 8)
+      : opt(opt), max_free(max_free) {}
+
+  // Returns a frame of exactly `len` pixels. Recycled frames keep their old
+  // contents.
+  FrameBuffer Acquire(size_t len);
+  // Keeps `frame` for reuse. When `max_free` frames are already kept, the
+  // oldest of them is freed.
+  void Release(FrameBuffer &&frame);
+
+ private:
+  FrameBufferOptions opt;
+  size_t max_free;
+
+  std::mutex mutex;
+  std::vector<FrameBuffer> free;
+};
+
+};  // namespace cvs
@@ -0,0 +1,99 @@
+#include "half.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define CVS_F16C
+#include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// GCC and Clang can compile the F16C loops without -mf16c, and pick them at
+// run time. -mavx2 does not imply F16C.
+#define CVS_F16C __attribute__((target("f16c")))
+#define CVS_F16C_DISPATCH
+#include <immintrin.h>
+#endif
+
+using cvs::half;
+
+namespace {
+
+#ifdef CVS_F16C
+CVS_F16C void half_to_float_f16c(const half *src, float *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+  }
+  for (; i < n; i++) dst[i] = cvs::HalfToFloat(src[i]);
+}
+
+CVS_F16C void float_to_half_f16c(const float *src, half *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i v =
+        _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+  }
+  for (; i < n; i++) dst[i] = cvs::FloatToHalf(src[i]);
+}
+#endif
+
+bool has_f16c() {
+#if defined(CVS_F16C_DISPATCH)
+  static const bool f16c = __builtin_cpu_supports("f16c");
+  return f16c;
+#elif defined(CVS_F16C)
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace
+
+void cvs::HalfToFloat(const half *src, float *dst, size_t n) {
+#ifdef CVS_F16C
+  if (has_f16c()) {
+    half_to_float_f16c(src, dst, n);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < n; i++) dst[i] = HalfToFloat(src[i]);
+}
+
+void cvs::FloatToHalf(const float *src, half *dst, size_t n) {
+#ifdef CVS_F16C
+  if (has_f16c()) {
+    float_to_half_f16c(src, dst, n);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < n; i++) dst[i] = FloatToHalf(src[i]);
+}
+
+void cvs::RunOnFloat(const FloatKernel &kernel, const half *src, half *dst,
+                     size_t begin, size_t end, size_t src_stride,
+                     size_t dst_stride) {
+  // 16 KB of float per buffer for RGBA, small enough to stay in cache.
+  constexpr size_t kBlock = 1024;
+  const size_t src_n = src_stride >= 4 ? 4 : 3;
+  const size_t dst_n = dst_stride >= 4 ? 4 : 3;
+  std::vector<float> in(kBlock * src_stride);
+  std::vector<float> out(kBlock * dst_n);
+  for (size_t i = begin; i < end; i += kBlock) {
+    const size_t n = std::min(kBlock, end - i);
+    // The last pixel of the frame need not have the padding of the stride.
+    HalfToFloat(src + i * src_stride, in.data(), (n - 1) * src_stride + src_n);
+    kernel(in.data(), out.data(), n, src_stride, dst_n);
+    if (dst_stride == dst_n) {
+      FloatToHalf(out.data(), dst + i * dst_stride, n * dst_n);
+    } else {
+      // Leave the padding of the destination alone.
+      for (size_t j = 0; j < n; j++) {
+        FloatToHalf(out.data() + j * dst_n, dst + (i + j) * dst_stride, dst_n);
+      }
+    }
+  }
+}
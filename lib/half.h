@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include "cvs.h"
+
+namespace cvs {
+
+inline float HalfToFloat(half h) {
+  const uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+  uint32_t exp = (h.bits >> 10) & 0x1F;
+  uint32_t mant = h.bits & 0x3FF;
+  uint32_t bits;
+  if (exp == 0x1F) {
+    bits = sign | 0x7F800000 | mant << 13;
+  } else if (exp != 0) {
+    bits = sign | (exp + 112) << 23 | mant << 13;
+  } else if (mant == 0) {
+    bits = sign;
+  } else {
+    // Subnormal half, normal float.
+    exp = 113;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      exp--;
+    }
+    bits = sign | exp << 23 | (mant & 0x3FF) << 13;
+  }
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// Rounds to nearest even, like F16C.
+inline half FloatToHalf(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint16_t sign = (x >> 16) & 0x8000;
+  const uint32_t abs = x & 0x7FFFFFFF;
+
+  if (abs > 0x7F800000) return half{ uint16_t(sign | 0x7E00) };
+  if (abs >= 0x477FF000) return half{ uint16_t(sign | 0x7C00) };
+  if (abs < 0x38800000) {
+    // Subnormal half.
+    if (abs <= 0x33000000) return half{ sign };
+    const uint32_t shift = 126 - (abs >> 23);
+    const uint32_t m = (abs & 0x7FFFFF) | 0x800000;
+    uint32_t h = m >> shift;
+    const uint32_t rem = m & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (h & 1))) h++;
+    return half{ uint16_t(sign | h) };
+  }
+
+  uint32_t h = (abs - 0x38000000) >> 13;
+  const uint32_t rem = abs & 0x1FFF;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+  return half{ uint16_t(sign | h) };
+}
+
+// Convert `n` consecutive values, with F16C when the CPU has it, whether or
+// not the compiler targets it.
+void HalfToFloat(const half *src, float *dst, size_t n);
+void FloatToHalf(const float *src, half *dst, size_t n);
+
+// Runs a float kernel on pixels [begin, end) of strided half frames. Pixels go
+// through float in blocks, so the conversions run in bulk rather than per
+// pixel. The kernel gets the source stride and a packed destination.
+using FloatKernel = std::function<void(const float *src, float *dst,
+                                       size_t len, size_t src_stride,
+                                       size_t dst_stride)>;
+void RunOnFloat(const FloatKernel &kernel, const half *src, half *dst,
+                size_t begin, size_t end, size_t src_stride,
+                size_t dst_stride);
+
+};  // namespace cvs
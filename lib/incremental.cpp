@@ -0,0 +1,111 @@
+#include "incremental.h"
+
+#include <algorithm>
+#include <cstring>
+
+cvs::IncrementalSimulator::IncrementalSimulator(int width, int height,
+                                                SimulateFunc simulate,
+                                                int tile_size)
+    : width(width),
+      height(height),
+      tile_size(tile_size),
+      tiles_x((width + tile_size - 1) / tile_size),
+      tiles_y((height + tile_size - 1) / tile_size),
+      simulate(std::move(simulate)),
+      prev_src(size_t(width) * height),
+      out(size_t(width) * height),
+      dirty_tiles(size_t(tiles_x) * tiles_y) {}
+
+// memcmp is vectorised by the C library, and most unchanged tiles are
+// rejected by their first rows.
+bool cvs::IncrementalSimulator::tile_changed(const BGRA *src, int tx,
+                                             int ty) const {
+  const int x0 = tx * tile_size;
+  const int y0 = ty * tile_size;
+  const size_t bytes = std::min(tile_size, width - x0) * sizeof(BGRA);
+  const int y1 = std::min(y0 + tile_size, height);
+  for (int y = y0; y < y1; y++) {
+    const size_t offset = size_t(y) * width + x0;
+    if (std::memcmp(src + offset, prev_src.data() + offset, bytes) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void cvs::IncrementalSimulator::mark_rect(const Rect &rect) {
+  const int x0 = std::max(rect.x, 0);
+  const int y0 = std::max(rect.y, 0);
+  const int x1 = std::min(rect.x + rect.width, width);
+  const int y1 = std::min(rect.y + rect.height, height);
+  if (x0 >= x1 || y0 >= y1) return;
+
+  for (int ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++) {
+    for (int tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++) {
+      dirty_tiles[size_t(ty) * tiles_x + tx] = 1;
+    }
+  }
+}
+
+const cvs::BGRA *cvs::IncrementalSimulator::Process(
+    const BGRA *src, const std::vector<Rect> *dirty) {
+  if (!has_prev) {
+    std::fill(dirty_tiles.begin(), dirty_tiles.end(), 1);
+  } else if (dirty) {
+    std::fill(dirty_tiles.begin(), dirty_tiles.end(), 0);
+    for (const auto &rect : *dirty) mark_rect(rect);
+  } else {
+    const int count = tiles_x * tiles_y;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+    for (int i = 0; i < count; i++) {
+      dirty_tiles[i] = tile_changed(src, i % tiles_x, i / tiles_x);
+    }
+  }
+
+  // Neighbouring dirty tiles of a tile row become one span, so the backend
+  // sees rows as long as possible.
+  struct Span {
+    int ty;
+    int tx0;
+    int tx1;
+  };
+  std::vector<Span> spans;
+  updated_tiles = 0;
+  for (int ty = 0; ty < tiles_y; ty++) {
+    const uint8_t *row = dirty_tiles.data() + size_t(ty) * tiles_x;
+    for (int tx = 0; tx < tiles_x;) {
+      if (!row[tx]) {
+        tx++;
+        continue;
+      }
+      int end = tx;
+      while (end < tiles_x && row[end]) end++;
+      spans.push_back(Span{ ty, tx, end });
+      updated_tiles += end - tx;
+      tx = end;
+    }
+  }
+
+  const int span_count = spans.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < span_count; i++) {
+    const Span &span = spans[i];
+    const int x0 = span.tx0 * tile_size;
+    const int x1 = std::min(span.tx1 * tile_size, width);
+    const int y0 = span.ty * tile_size;
+    const int y1 = std::min(y0 + tile_size, height);
+    for (int y = y0; y < y1; y++) {
+      const size_t offset = size_t(y) * width + x0;
+      simulate(src + offset, out.data() + offset, x1 - x0);
+      std::memcpy(prev_src.data() + offset, src + offset,
+                  (x1 - x0) * sizeof(BGRA));
+    }
+  }
+
+  has_prev = true;
+  return out.data();
+}
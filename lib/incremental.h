@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "cvs.h"
+
+namespace cvs {
+
+struct Rect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// Keeps the previous input and output of a fixed-size frame and recomputes
+// only the tiles that changed, for screen capture and video where consecutive
+// frames are mostly identical.
+class IncrementalSimulator {
+ public:
+  // `simulate` is called on single rows of tiles from several threads at once,
+  // so it should be one of the single-threaded backends.
+  using SimulateFunc =
+      std::function<void(const BGRA *src, BGRA *dst, size_t len)>;
+
+  IncrementalSimulator(int width, int height, SimulateFunc simulate,
+                       int tile_size = 64);
+
+  // Simulates a tightly packed width * height frame. The returned frame stays
+  // valid until the next call. When `dirty` is given, only tiles touching
+  // those rectangles are recomputed and the rest of `src` is not looked at;
+  // otherwise tiles are compared with the previous frame.
+  const BGRA *Process(const BGRA *src,
+                      const std::vector<Rect> *dirty = nullptr);
+
+  // Makes the next Process recompute the whole frame, e.g. after the
+  // deficiency or severity captured by `simulate` changed.
+  void Reset() { has_prev = false; }
+
+  size_t tile_count() const { return dirty_tiles.size(); }
+  size_t last_updated_tiles() const { return updated_tiles; }
+
+ private:
+  bool tile_changed(const BGRA *src, int tx, int ty) const;
+  void mark_rect(const Rect &rect);
+
+  int width;
+  int height;
+  int tile_size;
+  int tiles_x;
+  int tiles_y;
+  SimulateFunc simulate;
+
+  std::vector<BGRA> prev_src;
+  std::vector<BGRA> out;
+  std::vector<uint8_t> dirty_tiles;
+  bool has_prev = false;
+  size_t updated_tiles = 0;
+};
+
+};  // namespace cvs
@@ -21,6 +21,26 @@ inline uchar4 ToSRGB(float4 v) {
     return convert_uchar4(srgb);
 }
 
+inline float4 Brettel(float4 bgra, __constant float *params) {
+    float x = dot(bgra.xyz, vload3(6, params));
+    int offset = isless(x, 0) * 3;
+    return (float4)(
+        dot(bgra.xyz, vload3(offset + 0, params)),
+        dot(bgra.xyz, vload3(offset + 1, params)),
+        dot(bgra.xyz, vload3(offset + 2, params)),
+        bgra.w
+    );
+}
+
+inline float4 Vienot(float4 bgra, __constant float *mat) {
+    return (float4)(
+        dot(bgra.xyz, vload3(0, mat)),
+        dot(bgra.xyz, vload3(1, mat)),
+        dot(bgra.xyz, vload3(2, mat)),
+        bgra.w
+    );
+}
+
 __kernel void Brettel1997(
     __global uchar4 *src,
     __global uchar4 *dst,
@@ -30,17 +50,7 @@ __kernel void Brettel1997(
     size_t i = get_global_id(0);
 
     float4 bgra = ToLinearRGB(src[i]);
-
-    float x = dot(bgra.xyz, vload3(6, params));
-    int offset = isless(x, 0) * 3;
-    float4 bgra_cvd = (float4)(
-        dot(bgra.xyz, vload3(offset + 0, params)),
-        dot(bgra.xyz, vload3(offset + 1, params)),
-        dot(bgra.xyz, vload3(offset + 2, params)),
-        bgra.w
-    );
-
-    dst[i] = ToSRGB(mix(bgra, bgra_cvd, severity));
+    dst[i] = ToSRGB(mix(bgra, Brettel(bgra, params), severity));
 }
 
 __kernel void Vienot1999(
@@ -52,14 +62,108 @@ __kernel void Vienot1999(
     size_t i = get_global_id(0);
 
     float4 bgra = ToLinearRGB(src[i]);
-    float4 bgra_cvd = (float4)(
-        dot(bgra.xyz, vload3(0, mat)),
-        dot(bgra.xyz, vload3(1, mat)),
-        dot(bgra.xyz, vload3(2, mat)),
-        bgra.w
+    dst[i] = ToSRGB(mix(bgra, Vienot(bgra, mat), severity));
+}
+
+inline float4 LoadLinear(__global const float *src, size_t i, uint stride) {
+    if (stride == 4) return vload4(i, src).zyxw;
+    __global const float *p = src + i * stride;
+    return (float4)(p[2], p[1], p[0], stride > 4 ? p[3] : 1.f);
+}
+
+inline void StoreLinear(float4 v, __global float *dst, size_t i, uint stride) {
+    if (stride == 4) {
+        vstore4(v.zyxw, i, dst);
+        return;
+    }
+    __global float *p = dst + i * stride;
+    p[0] = v.z;
+    p[1] = v.y;
+    p[2] = v.x;
+    if (stride > 4) p[3] = v.w;
+}
+
+inline float4 LoadLinearHalf(__global const half *src, size_t i, uint stride) {
+    if (stride == 4) return vload_half4(i, src).zyxw;
+    size_t j = i * stride;
+    return (float4)(
+        vload_half(j + 2, src),
+        vload_half(j + 1, src),
+        vload_half(j, src),
+        stride > 4 ? vload_half(j + 3, src) : 1.f
     );
+}
+
+inline void StoreLinearHalf(float4 v, __global half *dst, size_t i, uint stride) {
+    if (stride == 4) {
+        vstore_half4(v.zyxw, i, dst);
+        return;
+    }
+    size_t j = i * stride;
+    vstore_half(v.z, j, dst);
+    vstore_half(v.y, j + 1, dst);
+    vstore_half(v.x, j + 2, dst);
+    if (stride > 4) vstore_half(v.w, j + 3, dst);
+}
+
+__kernel void Brettel1997Linear(
+    __global const float *src,
+    __global float *dst,
+    __constant float *params,
+    const float severity,
+    const uint src_stride,
+    const uint dst_stride)
+{
+    size_t i = get_global_id(0);
+
+    float4 bgra = LoadLinear(src, i, src_stride);
+    float4 bgra_cvd = mix(bgra, Brettel(bgra, params), severity);
+    StoreLinear(bgra_cvd, dst, i, dst_stride);
+}
+
+__kernel void Vienot1999Linear(
+    __global const float *src,
+    __global float *dst,
+    __constant float *mat,
+    const float severity,
+    const uint src_stride,
+    const uint dst_stride)
+{
+    size_t i = get_global_id(0);
+
+    float4 bgra = LoadLinear(src, i, src_stride);
+    float4 bgra_cvd = mix(bgra, Vienot(bgra, mat), severity);
+    StoreLinear(bgra_cvd, dst, i, dst_stride);
+}
+
+__kernel void Brettel1997LinearHalf(
+    __global const half *src,
+    __global half *dst,
+    __constant float *params,
+    const float severity,
+    const uint src_stride,
+    const uint dst_stride)
+{
+    size_t i = get_global_id(0);
+
+    float4 bgra = LoadLinearHalf(src, i, src_stride);
+    float4 bgra_cvd = mix(bgra, Brettel(bgra, params), severity);
+    StoreLinearHalf(bgra_cvd, dst, i, dst_stride);
+}
+
+__kernel void Vienot1999LinearHalf(
+    __global const half *src,
+    __global half *dst,
+    __constant float *mat,
+    const float severity,
+    const uint src_stride,
+    const uint dst_stride)
+{
+    size_t i = get_global_id(0);
 
-    dst[i] = ToSRGB(mix(bgra, bgra_cvd, severity));
+    float4 bgra = LoadLinearHalf(src, i, src_stride);
+    float4 bgra_cvd = mix(bgra, Vienot(bgra, mat), severity);
+    StoreLinearHalf(bgra_cvd, dst, i, dst_stride);
 }
 
 )
@@ -0,0 +1,449 @@
+#include "server.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+using cvs::BGRA;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kRegistryMagic = 0x52535643;  // "CVSR"
+constexpr uint32_t kRingMagic = 0x47525643;      // "CVRG"
+constexpr size_t kPageSize = 4096;
+
+enum SlotState : uint32_t {
+  kFree,
+  kClaimed,
+  kActive,
+};
+
+// Counters shared between processes are waited on directly with futex, so
+// they have to be plain 32-bit words.
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+struct ClientEntry {
+  std::atomic<uint32_t> state;
+  int32_t pid;
+  char ring_name[56];
+};
+
+struct Registry {
+  uint32_t magic;
+  int32_t server_pid;
+  // Bumped by clients on every submit and (un)registration.
+  alignas(64) std::atomic<uint32_t> doorbell;
+  alignas(64) ClientEntry clients[cvs::server::kMaxClients];
+};
+
+struct FrameDesc {
+  cvs::server::FrameRequest request;
+  int32_t status;
+};
+
+struct RingHeader {
+  uint32_t magic;
+  uint32_t slot_count;
+  uint64_t slot_pixels;
+  uint64_t slot_bytes;
+  uint64_t data_offset;
+  uint64_t total_bytes;
+  // Written by the client only.
+  alignas(64) std::atomic<uint32_t> submitted;
+  std::atomic<uint32_t> closed;
+  // Written by the server only.
+  alignas(64) std::atomic<uint32_t> completed;
+  alignas(64) FrameDesc frames[cvs::server::kMaxSlots];
+};
+
+uint32_t* futex_word(std::atomic<uint32_t>& a) {
+  return reinterpret_cast<uint32_t*>(&a);
+}
+
+// Shared (not FUTEX_PRIVATE) operations, since the words live in segments
+// mapped by several processes.
+void futex_wake(std::atomic<uint32_t>& a) {
+  syscall(SYS_futex, futex_word(a), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+void futex_wait(std::atomic<uint32_t>& a, uint32_t expected,
+                std::chrono::nanoseconds timeout) {
+  timespec ts;
+  ts.tv_sec = timeout.count() / 1'000'000'000;
+  ts.tv_nsec = timeout.count() % 1'000'000'000;
+  syscall(SYS_futex, futex_word(a), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+size_t round_up(size_t n, size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+// Maps a whole shared memory object. Returns nullptr on failure.
+void* map_shm(const std::string& name, int flags, size_t create_size,
+              size_t& size) {
+  const int fd = shm_open(name.c_str(), flags, 0600);
+  if (fd < 0) return nullptr;
+  if (create_size > 0 && ftruncate(fd, create_size) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+  size = st.st_size;
+  void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+// Layout of a ring segment. The header lives in memory the client can write
+// at any time, so the server validates it once and keeps its own copy.
+struct RingGeometry {
+  uint32_t slot_count = 0;
+  uint64_t slot_pixels = 0;
+  uint64_t slot_bytes = 0;
+  uint64_t data_offset = 0;
+  // Size of the mapping.
+  uint64_t total_bytes = 0;
+};
+
+RingGeometry geometry(const RingHeader* ring) {
+  return RingGeometry{ ring->slot_count, ring->slot_pixels, ring->slot_bytes,
+                       ring->data_offset, ring->total_bytes };
+}
+
+// Whether every slot of `g` lies inside a mapping of `size` bytes.
+bool valid_geometry(const RingGeometry& g, size_t size) {
+  return g.slot_count > 0 && g.slot_count <= cvs::server::kMaxSlots &&
+         g.slot_pixels > 0 && g.slot_bytes % kPageSize == 0 &&
+         g.slot_pixels <= g.slot_bytes / sizeof(BGRA) &&
+         g.data_offset >= sizeof(RingHeader) &&
+         g.data_offset % kPageSize == 0 && g.data_offset <= size &&
+         g.slot_bytes <= (size - g.data_offset) / (2 * g.slot_count);
+}
+
+BGRA* slot_input(RingHeader* ring, const RingGeometry& g, uint32_t i) {
+  auto base = reinterpret_cast<uint8_t*>(ring) + g.data_offset;
+  return reinterpret_cast<BGRA*>(base + 2 * g.slot_bytes * i);
+}
+
+BGRA* slot_output(RingHeader* ring, const RingGeometry& g, uint32_t i) {
+  auto base = reinterpret_cast<uint8_t*>(ring) + g.data_offset;
+  return reinterpret_cast<BGRA*>(base + 2 * g.slot_bytes * i + g.slot_bytes);
+}
+
+}  // namespace
+
+struct cvs::server::Client::Impl {
+  Registry* registry = nullptr;
+  size_t registry_size = 0;
+  RingHeader* ring = nullptr;
+  std::string ring_name;
+  uint32_t entry = 0;
+
+  ~Impl() {
+    if (ring) {
+      ring->closed.store(1, std::memory_order_release);
+      munmap(ring, ring->total_bytes);
+      shm_unlink(ring_name.c_str());
+    }
+    if (registry) {
+      registry->doorbell.fetch_add(1, std::memory_order_release);
+      futex_wake(registry->doorbell);
+      munmap(registry, registry_size);
+    }
+  }
+};
+
+std::unique_ptr<cvs::server::Client> cvs::server::Client::Connect(
+    const std::string& name, size_t max_pixels, uint32_t slots) {
+  if (slots == 0 || slots > kMaxSlots || max_pixels == 0) return nullptr;
+
+  auto impl = std::make_unique<Impl>();
+  void* reg = map_shm(name, O_RDWR, 0, impl->registry_size);
+  if (!reg) return nullptr;
+  impl->registry = static_cast<Registry*>(reg);
+  if (impl->registry_size < sizeof(Registry) ||
+      impl->registry->magic != kRegistryMagic) {
+    munmap(reg, impl->registry_size);
+    impl->registry = nullptr;
+    return nullptr;
+  }
+
+  static std::atomic<uint32_t> counter{ 0 };
+  impl->ring_name = "/cvs_ring_" + std::to_string(getpid()) + "_" +
+                    std::to_string(counter.fetch_add(1));
+
+  // Page-aligned slots can be handed to every backend without copies.
+  const size_t slot_bytes = round_up(max_pixels * sizeof(BGRA), kPageSize);
+  const size_t data_offset = round_up(sizeof(RingHeader), kPageSize);
+  const size_t total = data_offset + 2 * slot_bytes * slots;
+  size_t size = 0;
+  shm_unlink(impl->ring_name.c_str());
+  void* ring = map_shm(impl->ring_name, O_RDWR | O_CREAT | O_EXCL, total, size);
+  if (!ring) return nullptr;
+  impl->ring = new (ring) RingHeader{};
+  impl->ring->magic = kRingMagic;
+  impl->ring->slot_count = slots;
+  impl->ring->slot_pixels = max_pixels;
+  impl->ring->slot_bytes = slot_bytes;
+  impl->ring->data_offset = data_offset;
+  impl->ring->total_bytes = total;
+
+  Registry* r = impl->registry;
+  for (uint32_t i = 0; i < kMaxClients; i++) {
+    uint32_t expected = kFree;
+    if (!r->clients[i].state.compare_exchange_strong(expected, kClaimed)) {
+      continue;
+    }
+    r->clients[i].pid = getpid();
+    std::strncpy(r->clients[i].ring_name, impl->ring_name.c_str(),
+                 sizeof(r->clients[i].ring_name) - 1);
+    r->clients[i].state.store(kActive, std::memory_order_release);
+    r->doorbell.fetch_add(1, std::memory_order_release);
+    futex_wake(r->doorbell);
+
+    impl->entry = i;
+    std::unique_ptr<Client> client(new Client());
+    client->impl = std::move(impl);
+    return client;
+  }
+  return nullptr;
+}
+
+cvs::server::Client::~Client() = default;
+
+size_t cvs::server::Client::max_pixels() const {
+  return impl->ring->slot_pixels;
+}
+
+BGRA* cvs::server::Client::BeginFrame() {
+  RingHeader* ring = impl->ring;
+  if (submitted - released == ring->slot_count) return nullptr;
+  return slot_input(ring, geometry(ring), submitted % ring->slot_count);
+}
+
+void cvs::server::Client::Submit(const FrameRequest& request) {
+  RingHeader* ring = impl->ring;
+  ring->frames[submitted % ring->slot_count] = FrameDesc{ request, 0 };
+  submitted++;
+  ring->submitted.store(submitted, std::memory_order_release);
+
+  Registry* r = impl->registry;
+  r->doorbell.fetch_add(1, std::memory_order_release);
+  futex_wake(r->doorbell);
+}
+
+cvs::server::Client::WaitResult cvs::server::Client::WaitFrame(
+    std::chrono::milliseconds timeout, const BGRA*& out) {
+  out = nullptr;
+  if (submitted == released) return WaitResult::Empty;
+
+  RingHeader* ring = impl->ring;
+  const auto deadline = Clock::now() + timeout;
+  for (;;) {
+    const uint32_t completed = ring->completed.load(std::memory_order_acquire);
+    if (completed != released) break;
+    const auto left = deadline - Clock::now();
+    if (left <= Clock::duration::zero()) return WaitResult::Timeout;
+    futex_wait(ring->completed, completed, left);
+  }
+
+  const uint32_t slot = released % ring->slot_count;
+  if (ring->frames[slot].status != 0) return WaitResult::Rejected;
+  out = slot_output(ring, geometry(ring), slot);
+  return WaitResult::Ok;
+}
+
+void cvs::server::Client::ReleaseFrame() {
+  if (released != submitted) released++;
+}
+
+struct cvs::server::Server::Impl {
+  struct Attached {
+    RingHeader* ring = nullptr;
+    RingGeometry geometry;
+    ClientStats stats;
+    Clock::time_point connected;
+  };
+
+  std::string name;
+  ServerOptions opt;
+  Registry* registry = nullptr;
+  size_t registry_size = 0;
+  Attached attached[kMaxClients];
+
+  void attach(uint32_t i) {
+    ClientEntry& entry = registry->clients[i];
+    size_t size = 0;
+    void* p = map_shm(entry.ring_name, O_RDWR, 0, size);
+    auto ring = static_cast<RingHeader*>(p);
+    RingGeometry g;
+    if (ring && size >= sizeof(RingHeader)) g = geometry(ring);
+    g.total_bytes = size;
+    if (!ring || size < sizeof(RingHeader) || ring->magic != kRingMagic ||
+        !valid_geometry(g, size)) {
+      // The client is already gone or the segment is not one of ours.
+      if (p) munmap(p, size);
+      entry.state.store(kFree, std::memory_order_release);
+      return;
+    }
+    attached[i].ring = ring;
+    attached[i].geometry = g;
+    attached[i].stats = ClientStats{};
+    attached[i].stats.pid = entry.pid;
+    attached[i].connected = Clock::now();
+  }
+
+  void detach(uint32_t i, bool crashed) {
+    Attached& a = attached[i];
+    update_time(a);
+    a.stats.connected = false;
+    if (opt.report) opt.report(a.stats);
+
+    munmap(a.ring, a.geometry.total_bytes);
+    a.ring = nullptr;
+    ClientEntry& entry = registry->clients[i];
+    // A client that went away without closing leaves its segment behind.
+    if (crashed) shm_unlink(entry.ring_name);
+    entry.state.store(kFree, std::memory_order_release);
+  }
+
+  void update_time(Attached& a) {
+    a.stats.connected_seconds =
+        std::chrono::duration<double>(Clock::now() - a.connected).count();
+  }
+
+  // Serves one frame of client `i` if it has one pending.
+  bool serve(const Engine& engine, uint32_t i) {
+    RingHeader* ring = attached[i].ring;
+    const RingGeometry& g = attached[i].geometry;
+    const uint32_t completed = ring->completed.load(std::memory_order_relaxed);
+    if (ring->submitted.load(std::memory_order_acquire) == completed) {
+      return false;
+    }
+
+    const uint32_t slot = completed % g.slot_count;
+    FrameDesc& desc = ring->frames[slot];
+    // Copied, so the client cannot change it between the check and the use.
+    const FrameRequest req = desc.request;
+    const bool valid = req.len <= g.slot_pixels &&
+                       uint32_t(req.method) <= uint32_t(Method::Machado2009) &&
+                       uint32_t(req.deficiency) <= uint32_t(Deficiency::Tritan);
+    if (valid) {
+      const auto start = Clock::now();
+      engine(req, slot_input(ring, g, slot), slot_output(ring, g, slot));
+      ClientStats& stats = attached[i].stats;
+      stats.busy_seconds +=
+          std::chrono::duration<double>(Clock::now() - start).count();
+      stats.frames++;
+      stats.bytes += req.len * sizeof(BGRA);
+    }
+    desc.status = valid ? 0 : -1;
+
+    ring->completed.store(completed + 1, std::memory_order_release);
+    futex_wake(ring->completed);
+    return true;
+  }
+};
+
+cvs::server::Server::Server(std::string name, ServerOptions opt)
+    : impl(std::make_unique<Impl>()) {
+  impl->name = std::move(name);
+  impl->opt = std::move(opt);
+}
+
+cvs::server::Server::~Server() {
+  if (!impl->registry) return;
+  for (uint32_t i = 0; i < kMaxClients; i++) {
+    if (impl->attached[i].ring) impl->detach(i, false);
+  }
+  munmap(impl->registry, impl->registry_size);
+  shm_unlink(impl->name.c_str());
+}
+
+bool cvs::server::Server::Open() {
+  size_t size = 0;
+  if (void* p = map_shm(impl->name, O_RDWR, 0, size)) {
+    const auto* old = static_cast<const Registry*>(p);
+    const pid_t pid = size >= sizeof(Registry) ? old->server_pid : 0;
+    munmap(p, size);
+    // EPERM means the process exists but belongs to another user.
+    if (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM)) return false;
+  }
+  shm_unlink(impl->name.c_str());
+  void* p = map_shm(impl->name, O_RDWR | O_CREAT | O_EXCL, sizeof(Registry),
+                    impl->registry_size);
+  if (!p) return false;
+  impl->registry = new (p) Registry{};
+  impl->registry->server_pid = getpid();
+  // Published last, clients check it before touching anything else.
+  std::atomic_thread_fence(std::memory_order_release);
+  impl->registry->magic = kRegistryMagic;
+  return true;
+}
+
+void cvs::server::Server::Run(const Engine& engine,
+                              const std::atomic<bool>& stop) {
+  Registry* r = impl->registry;
+  if (!r) return;
+
+  auto next_report = Clock::now() + impl->opt.report_interval;
+  while (!stop.load(std::memory_order_relaxed)) {
+    // Read before looking at the clients, so that a submit after the scan
+    // changes it and the wait below returns at once.
+    const uint32_t doorbell = r->doorbell.load(std::memory_order_acquire);
+
+    for (uint32_t i = 0; i < kMaxClients; i++) {
+      if (impl->attached[i].ring) continue;
+      if (r->clients[i].state.load(std::memory_order_acquire) == kActive) {
+        impl->attach(i);
+      }
+    }
+
+    // One frame per client and round, so a busy client cannot starve the
+    // others.
+    bool served = false;
+    for (uint32_t i = 0; i < kMaxClients; i++) {
+      if (impl->attached[i].ring) served |= impl->serve(engine, i);
+    }
+
+    for (uint32_t i = 0; i < kMaxClients; i++) {
+      auto& a = impl->attached[i];
+      if (!a.ring) continue;
+      if (a.ring->closed.load(std::memory_order_acquire)) {
+        impl->detach(i, false);
+      } else if (kill(a.stats.pid, 0) != 0 && errno == ESRCH) {
+        impl->detach(i, true);
+      }
+    }
+
+    if (Clock::now() >= next_report) {
+      next_report += impl->opt.report_interval;
+      for (auto& a : impl->attached) {
+        if (!a.ring) continue;
+        impl->update_time(a);
+        if (impl->opt.report) impl->opt.report(a.stats);
+      }
+    }
+
+    if (!served) {
+      futex_wait(r->doorbell, doorbell, std::chrono::milliseconds(100));
+    }
+  }
+}
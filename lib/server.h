@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cvs.h"
+
+// Frame exchange between cvs_server and its clients through POSIX shared
+// memory, Linux only.
+//
+// The server owns a registry segment with one entry per client. Each client
+// creates its own ring segment of `slot_count` frame slots, each with a page
+// aligned input and output area, and registers it. Pixels are written and
+// read in place on both sides; only the small frame descriptors and counters
+// are synchronised, and waiting is done on futexes in the shared segments.
+namespace cvs::server {
+
+constexpr const char* kDefaultName = "/cvs_server";
+constexpr uint32_t kMaxClients = 16;
+constexpr uint32_t kMaxSlots = 16;
+
+enum class Method : uint32_t {
+  Brettel1997,
+  Vienot1999,
+  Machado2009,
+};
+
+struct FrameRequest {
+  Method method = Method::Brettel1997;
+  Deficiency deficiency = Deficiency::Protan;
+  float severity = 1.f;
+  // Number of pixels in the input area.
+  uint64_t len = 0;
+};
+
+class Client {
+ public:
+  // Creates a ring of `slots` frames of up to `max_pixels` pixels and
+  // registers it with the server listening on `name`. Returns nullptr when
+  // no server is running or all client entries are taken.
+  static std::unique_ptr<Client> Connect(const std::string& name,
+                                         size_t max_pixels,
+                                         uint32_t slots = 4);
+  ~Client();
+
+  // Input area of the next free slot, or nullptr while every slot is waiting
+  // for the server or for ReleaseFrame.
+  BGRA* BeginFrame();
+  // Hands the frame from the last BeginFrame to the server.
+  void Submit(const FrameRequest& request);
+
+  enum class WaitResult {
+    Ok,
+    // Nothing was submitted since the last ReleaseFrame.
+    Empty,
+    Timeout,
+    // The server did not process the frame, e.g. because its request was
+    // invalid. The frame still has to be released.
+    Rejected,
+  };
+  // Waits for the oldest submitted frame. On Ok, `out` is its output, valid
+  // until ReleaseFrame.
+  WaitResult WaitFrame(std::chrono::milliseconds timeout, const BGRA*& out);
+  void ReleaseFrame();
+
+  size_t max_pixels() const;
+  uint32_t in_flight() const { return submitted - released; }
+
+ private:
+  Client() = default;
+
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+  uint32_t submitted = 0;
+  uint32_t released = 0;
+};
+
+using Engine = std::function<void(const FrameRequest& request,
+                                  const BGRA* src, BGRA* dst)>;
+
+struct ClientStats {
+  int pid = 0;
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  // Time spent in the engine for this client, and since it connected.
+  double busy_seconds = 0;
+  double connected_seconds = 0;
+  bool connected = true;
+
+  double FramesPerSecond() const {
+    return connected_seconds > 0 ? frames / connected_seconds : 0;
+  }
+  double GBps() const {
+    return connected_seconds > 0 ? bytes / connected_seconds / 1e9 : 0;
+  }
+};
+
+struct ServerOptions {
+  // Clients are reported at this interval, and once more when they leave.
+  std::chrono::milliseconds report_interval{ 5000 };
+  std::function<void(const ClientStats&)> report;
+};
+
+class Server {
+ public:
+  explicit Server(std::string name, ServerOptions opt = {});
+  ~Server();
+
+  // Creates the registry, replacing one left behind by a crashed server.
+  // Fails while the server that created an existing registry is running.
+  bool Open();
+  // Serves frames with `engine` round-robin, one per client at a time, until
+  // `stop` is set. Clients may connect and submit between Open and Run.
+  void Run(const Engine& engine, const std::atomic<bool>& stop);
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+};  // namespace cvs::server
@@ -0,0 +1,272 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CVS_STREAM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Whether a file of `size` bytes holds every pixel `header` promises.
+bool covers_pixels(const cvs::stream::RawHeader& header, uint64_t size) {
+  return size >= header.data_offset &&
+         (size - header.data_offset) / sizeof(cvs::BGRA) >=
+             uint64_t(header.width) * header.height;
+}
+
+// Runs `worker` on `count` threads and waits for all of them.
+template <typename F>
+void RunWorkers(int count, F worker) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < count; i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& th : threads) th.join();
+}
+
+#ifdef CVS_STREAM_MMAP
+// Page-aligned mapping that covers [offset, offset + size) of a file.
+class Window {
+ public:
+  Window(int fd, uint64_t offset, size_t size, int prot) {
+    static const uint64_t page = sysconf(_SC_PAGESIZE);
+    const uint64_t aligned = offset / page * page;
+    delta = offset - aligned;
+    length = size + delta;
+    base = mmap(nullptr, length, prot, MAP_SHARED, fd, aligned);
+    if (base == MAP_FAILED) base = nullptr;
+  }
+  ~Window() {
+    if (base) munmap(base, length);
+  }
+  Window(const Window&) = delete;
+  Window& operator=(const Window&) = delete;
+
+  bool valid() const { return base != nullptr; }
+  void* data() const { return static_cast<char*>(base) + delta; }
+  void advise(int advice) const { madvise(base, length, advice); }
+
+ private:
+  void* base;
+  size_t length;
+  uint64_t delta;
+};
+
+bool ProcessMmap(const std::string& input, const std::string& output,
+                 const cvs::stream::RawHeader& header,
+                 const cvs::stream::ChunkFunc& func,
+                 const cvs::stream::Options& opt, size_t chunk_px,
+                 size_t num_chunks) {
+  const int fd_in = open(input.c_str(), O_RDONLY);
+  const int fd_out = open(output.c_str(), O_RDWR);
+  // Mapping past the end of a file that is shorter than its header says, or
+  // was truncated since, raises SIGBUS on access instead of failing.
+  struct stat st_in, st_out;
+  if (fd_in < 0 || fd_out < 0 || fstat(fd_in, &st_in) != 0 ||
+      fstat(fd_out, &st_out) != 0 || !covers_pixels(header, st_in.st_size) ||
+      !covers_pixels(header, st_out.st_size)) {
+    if (fd_in >= 0) close(fd_in);
+    if (fd_out >= 0) close(fd_out);
+    return false;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (opt.sequential_hint) posix_fadvise(fd_in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  const uint64_t total = uint64_t(header.width) * header.height;
+  std::atomic<size_t> next = 0;
+  std::atomic<bool> ok = true;
+
+  RunWorkers(opt.in_flight, [&] {
+    for (size_t c = next++; c < num_chunks && ok; c = next++) {
+      const uint64_t first = c * chunk_px;
+      const size_t len = std::min<uint64_t>(chunk_px, total - first);
+      const size_t bytes = len * sizeof(cvs::BGRA);
+
+      Window src(fd_in, header.data_offset + first * sizeof(cvs::BGRA), bytes,
+                 PROT_READ);
+      Window dst(fd_out,
+                 cvs::stream::kRawDataOffset + first * sizeof(cvs::BGRA),
+                 bytes, PROT_READ | PROT_WRITE);
+      if (!src.valid() || !dst.valid()) {
+        ok = false;
+        break;
+      }
+
+      if (opt.sequential_hint) {
+        src.advise(MADV_SEQUENTIAL);
+        src.advise(MADV_WILLNEED);
+#ifdef POSIX_FADV_WILLNEED
+        // Start reading the chunk the next idle worker will pick up.
+        const uint64_t ahead = first + uint64_t(opt.in_flight) * chunk_px;
+        if (ahead < total) {
+          posix_fadvise(fd_in, header.data_offset + ahead * sizeof(cvs::BGRA),
+                        chunk_px * sizeof(cvs::BGRA), POSIX_FADV_WILLNEED);
+        }
+#endif
+      }
+
+      func(static_cast<const cvs::BGRA*>(src.data()),
+           static_cast<cvs::BGRA*>(dst.data()), len);
+    }
+  });
+
+  close(fd_in);
+  close(fd_out);
+  return ok;
+}
+#endif  // CVS_STREAM_MMAP
+
+bool ProcessRead(const std::string& input, const std::string& output,
+                 const cvs::stream::RawHeader& header,
+                 const cvs::stream::ChunkFunc& func,
+                 const cvs::stream::Options& opt, size_t chunk_px,
+                 size_t num_chunks) {
+  std::ifstream ifs(input, std::ios::binary);
+  std::fstream ofs(output, std::ios::binary | std::ios::in | std::ios::out);
+  if (!ifs || !ofs) return false;
+
+  const uint64_t total = uint64_t(header.width) * header.height;
+  std::mutex in_mutex;
+  std::mutex out_mutex;
+  std::atomic<size_t> next = 0;
+  std::atomic<bool> ok = true;
+
+  RunWorkers(opt.in_flight, [&] {
+    std::vector<cvs::BGRA> src(chunk_px);
+    std::vector<cvs::BGRA> dst(chunk_px);
+    for (size_t c = next++; c < num_chunks && ok; c = next++) {
+      const uint64_t first = c * chunk_px;
+      const size_t len = std::min<uint64_t>(chunk_px, total - first);
+      const std::streamsize bytes = len * sizeof(cvs::BGRA);
+
+      {
+        std::lock_guard lock(in_mutex);
+        ifs.seekg(header.data_offset + first * sizeof(cvs::BGRA));
+        ifs.read(reinterpret_cast<char*>(src.data()), bytes);
+        if (ifs.gcount() != bytes) {
+          ok = false;
+          break;
+        }
+      }
+
+      func(src.data(), dst.data(), len);
+
+      {
+        std::lock_guard lock(out_mutex);
+        ofs.seekp(cvs::stream::kRawDataOffset + first * sizeof(cvs::BGRA));
+        ofs.write(reinterpret_cast<const char*>(dst.data()), bytes);
+        if (!ofs) {
+          ok = false;
+          break;
+        }
+      }
+    }
+  });
+
+  return ok;
+}
+
+}  // namespace
+
+bool cvs::stream::ReadHeader(const std::string& path, RawHeader& header) {
+  std::ifstream ifs(path, std::ios::binary);
+  ifs.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!ifs || std::memcmp(header.magic, kRawMagic, sizeof(kRawMagic)) != 0) {
+    return false;
+  }
+  std::error_code ec;
+  const uint64_t size = std::filesystem::file_size(path, ec);
+  return !ec && header.data_offset >= sizeof(RawHeader) &&
+         covers_pixels(header, size);
+}
+
+bool cvs::stream::CreateRawFile(const std::string& path, uint32_t width,
+                                uint32_t height) {
+  RawHeader header{};
+  std::memcpy(header.magic, kRawMagic, sizeof(kRawMagic));
+  header.width = width;
+  header.height = height;
+  header.data_offset = kRawDataOffset;
+
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  const uint64_t size =
+      kRawDataOffset + uint64_t(width) * height * sizeof(BGRA);
+  // Writing the last byte sizes the file without touching the pixel area.
+  ofs.seekp(size - 1);
+  ofs.put('\0');
+  return bool(ofs);
+}
+
+bool cvs::stream::WriteRawFile(const std::string& path, uint32_t width,
+                               uint32_t height, const BGRA* pixels) {
+  if (!CreateRawFile(path, width, height)) return false;
+  std::fstream ofs(path, std::ios::binary | std::ios::in | std::ios::out);
+  ofs.seekp(kRawDataOffset);
+  ofs.write(reinterpret_cast<const char*>(pixels),
+            uint64_t(width) * height * sizeof(BGRA));
+  return bool(ofs);
+}
+
+bool cvs::stream::ReadRawFile(const std::string& path, RawHeader& header,
+                              std::vector<BGRA>& pixels) {
+  if (!ReadHeader(path, header)) return false;
+  std::ifstream ifs(path, std::ios::binary);
+  ifs.seekg(header.data_offset);
+  pixels.resize(size_t(header.width) * header.height);
+  ifs.read(reinterpret_cast<char*>(pixels.data()),
+           pixels.size() * sizeof(BGRA));
+  return bool(ifs);
+}
+
+bool cvs::stream::Process(const std::string& input, const std::string& output,
+                          const ChunkFunc& func, const Options& opt,
+                          Stats* stats) {
+  const auto start = std::chrono::steady_clock::now();
+
+  RawHeader header;
+  if (!ReadHeader(input, header)) return false;
+  // Creating the output truncates it, which would destroy the input first.
+  std::error_code ec;
+  if (std::filesystem::equivalent(input, output, ec)) return false;
+  if (!CreateRawFile(output, header.width, header.height)) return false;
+
+  const uint64_t total = uint64_t(header.width) * header.height;
+  const size_t chunk_px = std::max<size_t>(1, opt.chunk_bytes / sizeof(BGRA));
+  const size_t num_chunks = (total + chunk_px - 1) / chunk_px;
+  Options o = opt;
+  o.in_flight = std::max(1, opt.in_flight);
+
+  bool ok;
+#ifdef CVS_STREAM_MMAP
+  if (o.mode == IOMode::Mmap) {
+    ok = ProcessMmap(input, output, header, func, o, chunk_px, num_chunks);
+  } else {
+    ok = ProcessRead(input, output, header, func, o, chunk_px, num_chunks);
+  }
+#else
+  ok = ProcessRead(input, output, header, func, o, chunk_px, num_chunks);
+#endif
+
+  if (stats) {
+    stats->bytes = total * sizeof(BGRA);
+    stats->chunks = num_chunks;
+    stats->seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  }
+  return ok;
+}
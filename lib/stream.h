@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cvs.h"
+
+namespace cvs::stream {
+
+// Raw frame file: a RawHeader followed by `height` rows of `width` BGRA
+// pixels, starting at `data_offset`.
+struct RawHeader {
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  uint64_t data_offset;
+  uint64_t reserved;
+};
+
+constexpr char kRawMagic[8] = { 'C', 'V', 'S', 'R', 'A', 'W', '1', '\0' };
+constexpr uint64_t kRawDataOffset = 64;
+
+bool ReadHeader(const std::string& path, RawHeader& header);
+
+// Writes the header and extends the file to its full size so the pixel area
+// can be filled in any order.
+bool CreateRawFile(const std::string& path, uint32_t width, uint32_t height);
+
+bool WriteRawFile(const std::string& path, uint32_t width, uint32_t height,
+                  const BGRA* pixels);
+bool ReadRawFile(const std::string& path, RawHeader& header,
+                 std::vector<BGRA>& pixels);
+
+enum class IOMode {
+  // Map a window of the input and output per chunk. Falls back to Read where
+  // mmap is unavailable.
+  Mmap,
+  // Read and write chunks through file streams.
+  Read,
+};
+
+struct Options {
+  IOMode mode = IOMode::Mmap;
+  size_t chunk_bytes = 64 << 20;
+  // Number of chunks being read, simulated or written at the same time. The
+  // resident set stays around 2 * in_flight * chunk_bytes.
+  int in_flight = 4;
+  // madvise(MADV_SEQUENTIAL) and read-ahead of the next chunk in Mmap mode.
+  bool sequential_hint = true;
+};
+
+struct Stats {
+  uint64_t bytes = 0;
+  size_t chunks = 0;
+  double seconds = 0;
+
+  double GBps() const { return seconds > 0 ? bytes / seconds / 1e9 : 0; }
+};
+
+using ChunkFunc = std::function<void(const BGRA* src, BGRA* dst, size_t len)>;
+
+// Streams every pixel of the raw file `input` through `func` into `output`.
+// `output` is created with the same dimensions and must not be `input`.
+bool Process(const std::string& input, const std::string& output,
+             const ChunkFunc& func, const Options& opt, Stats* stats);
+
+};  // namespace cvs::stream
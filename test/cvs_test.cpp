@@ -1,9 +1,12 @@
 #include <cmath>
+#include <cstring>
 #include <filesystem>
 #include <format>
 #include <functional>
 #include <iostream>
+#include <random>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -14,17 +17,27 @@
 
 #include "cvs.h"
 #include "daltonlens.h"
+#ifdef CVS_HAS_OPENCL
 #include "daltonlens_cl.h"
+#endif
+#ifdef CVS_HAS_OPENMP
 #include "daltonlens_omp.h"
+#endif
+#include "daltonlens_par.h"
+#include "dedup.h"
+#include "frame_buffer.h"
+#include "half.h"
+#include "incremental.h"
+#include "stream.h"
 
 namespace fs = std::filesystem;
 
 struct Image {
   int width;
   int height;
-  std::vector<cvs::BGRA> pixels;
+  cvs::FrameBuffer pixels;
 
-  Image(int w, int h) : width(w), height(h), pixels(w * h) {}
+  Image(int w, int h) : width(w), height(h), pixels(size_t(w) * h) {}
 };
 
 struct TestCase {
@@ -50,7 +63,7 @@ Image load_image(const fs::path& p) {
     return im;
   }
 
-  im.pixels.resize(im.width * im.height);
+  im.pixels = cvs::FrameBuffer(size_t(im.width) * im.height);
   for (size_t i = 0; i < im.pixels.size(); i++) {
     im.pixels[i] = cvs::BGRA{
       raw[i * 4 + 2],
@@ -82,7 +95,11 @@ T abs_diff(const T a, const T b) {
   return a - b;
 }
 
+int failures = 0;
+
 using SimFunc = std::function<void(const Image&, Image&, const TestCase&)>;
+// Compares with the reference images in `input_dir`; a difference of more than
+// 1 in any colour channel fails the run.
 void test(const fs::path& input_dir, const fs::path& output_dir,
           const std::string& impl_name, const std::string& method_name,
           SimFunc simulate) {
@@ -97,6 +114,14 @@ void test(const fs::path& input_dir, const fs::path& output_dir,
     write_image(impl_dir / filename, im_simulated);
 
     const auto im_ref = load_image(input_dir / filename);
+    if (im_ref.pixels.size() == 0 ||
+        im_ref.pixels.size() != im_input.pixels.size()) {
+      failures++;
+      std::cout << std::format("impl: {}, method: {}, param: {}, no reference",
+                               impl_name, method_name, tc.param_str)
+                << std::endl;
+      continue;
+    }
     Image im_abs(im_input.width, im_input.height);
     cvs::BGRA max_diff{ 0, 0, 0, 0 };
     for (size_t i = 0; i < im_input.pixels.size(); i++) {
@@ -117,14 +142,186 @@ void test(const fs::path& input_dir, const fs::path& output_dir,
       };
     }
     write_image(impl_dir / ("abs_" + filename), im_abs);
+    const bool ok = max_diff.r <= 1 && max_diff.g <= 1 && max_diff.b <= 1;
+    if (!ok) failures++;
     std::cout << std::format(
-                     "impl: {}, method: {}, param: {}, max diff: ({},{},{})",
+                     "impl: {}, method: {}, param: {}, max diff: ({},{},{}){}",
                      impl_name, method_name, tc.param_str, max_diff.r,
-                     max_diff.g, max_diff.b)
+                     max_diff.g, max_diff.b, ok ? "" : " FAILED")
+              << std::endl;
+  }
+}
+
+float linear_from_srgb(uint8_t v) {
+  float fv = v / 255.f;
+  if (fv < 0.04045f) return fv / 12.92f;
+  return std::pow((fv + 0.055f) / 1.055f, 2.4f);
+}
+
+uint8_t srgb_from_linear(float v) {
+  if (v <= 0.f) return 0;
+  if (v >= 1.f) return 255;
+  if (v < 0.0031308f) return 0.5f + (v * 12.92f * 255.f);
+  return 0.f + 255.f * (std::pow(v, 1.f / 2.4f) * 1.055f - 0.055f);
+}
+
+float to_float(float v) { return v; }
+float to_float(cvs::half v) { return cvs::HalfToFloat(v); }
+void from_float(float v, float& out) { out = v; }
+void from_float(float v, cvs::half& out) { out = cvs::FloatToHalf(v); }
+
+// Adapts a linear-light entry point to the 8-bit test images, converting with
+// the same transfer functions as the 8-bit backends.
+template <typename T>
+using LinearFunc =
+    std::function<void(const T* src, T* dst, size_t len, const TestCase& tc)>;
+template <typename T>
+SimFunc linear(size_t src_stride, size_t dst_stride, LinearFunc<T> simulate) {
+  return [=](const Image& src, Image& dst, const TestCase& tc) {
+    const size_t len = src.pixels.size();
+    std::vector<T> lin_src(len * src_stride);
+    std::vector<T> lin_dst(len * dst_stride);
+    for (size_t i = 0; i < len; i++) {
+      const auto& px = src.pixels[i];
+      T* p = lin_src.data() + i * src_stride;
+      from_float(linear_from_srgb(px.r), p[0]);
+      from_float(linear_from_srgb(px.g), p[1]);
+      from_float(linear_from_srgb(px.b), p[2]);
+      if (src_stride >= 4) from_float(px.a / 255.f, p[3]);
+    }
+
+    simulate(lin_src.data(), lin_dst.data(), len, tc);
+
+    for (size_t i = 0; i < len; i++) {
+      const T* p = lin_dst.data() + i * dst_stride;
+      dst.pixels[i] = cvs::BGRA{
+        srgb_from_linear(to_float(p[2])),
+        srgb_from_linear(to_float(p[1])),
+        srgb_from_linear(to_float(p[0])),
+        src.pixels[i].a,
+      };
+    }
+  };
+}
+
+// Runs two implementations of the same operation on `input` and checks that
+// they agree within `tolerance` per colour channel, and exactly in alpha.
+void check(const std::string& name, const Image& input, SimFunc actual,
+           SimFunc expected, int tolerance) {
+  Image im_actual(input.width, input.height);
+  Image im_expected(input.width, input.height);
+  for (const auto& tc : kTestCases) {
+    actual(input, im_actual, tc);
+    expected(input, im_expected, tc);
+
+    cvs::BGRA max_diff{ 0, 0, 0, 0 };
+    for (size_t i = 0; i < input.pixels.size(); i++) {
+      const auto a = im_actual.pixels[i];
+      const auto e = im_expected.pixels[i];
+      max_diff = cvs::BGRA{
+        std::max(abs_diff(a.b, e.b), max_diff.b),
+        std::max(abs_diff(a.g, e.g), max_diff.g),
+        std::max(abs_diff(a.r, e.r), max_diff.r),
+        std::max(abs_diff(a.a, e.a), max_diff.a),
+      };
+    }
+    const bool ok = max_diff.r <= tolerance && max_diff.g <= tolerance &&
+                    max_diff.b <= tolerance && max_diff.a == 0;
+    if (!ok) failures++;
+    std::cout << std::format(
+                     "check: {}, param: {}, max diff: ({},{},{},{}){}", name,
+                     tc.param_str, max_diff.r, max_diff.g, max_diff.b,
+                     max_diff.a, ok ? "" : " FAILED")
               << std::endl;
   }
 }
 
+// Error redistribution of Fidaner et al. in linearRGB, row-major RGB.
+const float* daltonize_error_mat(cvs::Deficiency deficiency) {
+  static const float protan[9] = {
+    0.0, 0.0, 0.0,  //
+    0.7, 1.0, 0.0,  //
+    0.7, 0.0, 1.0,  //
+  };
+  static const float deutan[9] = {
+    1.0, 0.7, 0.0,  //
+    0.0, 0.0, 0.0,  //
+    0.0, 0.7, 1.0,  //
+  };
+  static const float tritan[9] = {
+    1.0, 0.0, 0.7,  //
+    0.0, 1.0, 0.7,  //
+    0.0, 0.0, 0.0,  //
+  };
+  switch (deficiency) {
+    case cvs::Deficiency::Protan:
+      return protan;
+    case cvs::Deficiency::Deutan:
+      return deutan;
+    case cvs::Deficiency::Tritan:
+      return tritan;
+  }
+  return nullptr;
+}
+
+// Daltonization in two passes, as it is usually written: simulate in float,
+// then add the error E * (rgb - sim) back onto the original.
+SimFunc daltonize_reference(LinearFunc<float> simulate) {
+  return linear<float>(
+      4, 4,
+      [=](const float* src, float* dst, size_t len, const TestCase& tc) {
+        simulate(src, dst, len, tc);
+        const float* e = daltonize_error_mat(tc.deficiency);
+        for (size_t i = 0; i < len; i++) {
+          const float* rgb = src + i * 4;
+          float* out = dst + i * 4;
+          const float err[3] = {
+            rgb[0] - out[0],
+            rgb[1] - out[1],
+            rgb[2] - out[2],
+          };
+          for (int c = 0; c < 3; c++) {
+            out[c] = rgb[c] + e[c * 3 + 0] * err[0] + e[c * 3 + 1] * err[1] +
+                     e[c * 3 + 2] * err[2];
+          }
+        }
+      });
+}
+
+// A screenshot-like image: `colours` random colours in runs of 37 pixels, and
+// an alpha that varies per pixel independently of the colour.
+Image palette_image(int width, int height, size_t colours) {
+  std::mt19937 mt(colours);
+  std::vector<uint32_t> palette(colours);
+  for (auto& c : palette) c = mt();
+
+  Image im(width, height);
+  for (size_t i = 0; i < im.pixels.size(); i++) {
+    const uint32_t c = palette[(i / 37) % palette.size()];
+    im.pixels[i] = cvs::BGRA{ uint8_t(c), uint8_t(c >> 8), uint8_t(c >> 16),
+                              uint8_t(i * 7) };
+  }
+  return im;
+}
+
+SimFunc dedup(const cvs::dedup::Options& opt, bool expect_deduplicated) {
+  return [=](const Image& src, Image& dst, const TestCase& tc) {
+    cvs::dedup::Stats stats;
+    cvs::dedup::Simulate(
+        [&](const cvs::BGRA* s, cvs::BGRA* d, size_t len) {
+          cvs::daltonlens::SimulateBrettel1997(tc.deficiency, tc.severity, s,
+                                               d, len);
+        },
+        src.pixels.data(), dst.pixels.data(), src.pixels.size(), opt, &stats);
+    if (stats.deduplicated != expect_deduplicated) {
+      failures++;
+      std::cout << std::format("dedup: expected the {} path",
+                               expect_deduplicated ? "deduplicated" : "direct")
+                << std::endl;
+    }
+  };
+}
+
 int main(int argc, const char* argv[]) {
   if (argc <= 2) {
     std::cout << "Usage: cvs_test <input dir> <output dir>" << std::endl;
@@ -150,6 +347,14 @@ int main(int argc, const char* argv[]) {
              src.pixels.size());
        });
 
+  test(input_dir, output_dir, "daltonlens", "machado2009",
+       [](const Image& src, Image& dst, const TestCase& tc) {
+         cvs::daltonlens::SimulateMachado2009(
+             tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+             src.pixels.size());
+       });
+
+#ifdef CVS_HAS_OPENMP
   // OpenMP
   test(input_dir, output_dir, "daltonlens_omp", "brettel1997",
        [](const Image& src, Image& dst, const TestCase& tc) {
@@ -165,11 +370,271 @@ int main(int argc, const char* argv[]) {
              src.pixels.size());
        });
 
+  test(input_dir, output_dir, "daltonlens_omp", "machado2009",
+       [](const Image& src, Image& dst, const TestCase& tc) {
+         cvs::daltonlens_omp::SimulateMachado2009(
+             tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+             src.pixels.size());
+       });
+#endif
+
+  // Parallel algorithms
+  test(input_dir, output_dir, "daltonlens_par", "brettel1997",
+       [](const Image& src, Image& dst, const TestCase& tc) {
+         cvs::daltonlens_par::SimulateBrettel1997(
+             tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+             src.pixels.size());
+       });
+
+  test(input_dir, output_dir, "daltonlens_par", "vienot1999",
+       [](const Image& src, Image& dst, const TestCase& tc) {
+         cvs::daltonlens_par::SimulateVienot1999(
+             tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+             src.pixels.size());
+       });
+
+  test(input_dir, output_dir, "daltonlens_par", "machado2009",
+       [](const Image& src, Image& dst, const TestCase& tc) {
+         cvs::daltonlens_par::SimulateMachado2009(
+             tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+             src.pixels.size());
+       });
+
+  // Linear light
+  test(input_dir, output_dir, "daltonlens_linear", "brettel1997",
+       linear<float>(4, 4, [](const float* src, float* dst, size_t len,
+                              const TestCase& tc) {
+         cvs::daltonlens::SimulateBrettel1997(tc.deficiency, tc.severity, src,
+                                              dst, len);
+       }));
+
+  // RGBA into a padded layout, which takes the per-pixel store.
+  test(input_dir, output_dir, "daltonlens_half", "brettel1997",
+       linear<cvs::half>(4, 5, [](const cvs::half* src, cvs::half* dst,
+                                  size_t len, const TestCase& tc) {
+         cvs::daltonlens::SimulateBrettel1997(tc.deficiency, tc.severity, src,
+                                              dst, len, 4, 5);
+       }));
+
+#ifdef CVS_HAS_OPENMP
+  test(input_dir, output_dir, "daltonlens_omp_half", "vienot1999",
+       linear<cvs::half>(3, 3, [](const cvs::half* src, cvs::half* dst,
+                                  size_t len, const TestCase& tc) {
+         cvs::daltonlens_omp::SimulateVienot1999(tc.deficiency, tc.severity,
+                                                 src, dst, len, 3, 3);
+       }));
+#endif
+
+  // Daltonization: the fused single pass against simulate-then-correct.
+  const auto im_input = load_image(input_dir / "input.png");
+  const auto brettel1997_daltonized = daltonize_reference(
+      [](const float* src, float* dst, size_t len, const TestCase& tc) {
+        cvs::daltonlens::SimulateBrettel1997(tc.deficiency, tc.severity, src,
+                                             dst, len);
+      });
+  const auto vienot1999_daltonized = daltonize_reference(
+      [](const float* src, float* dst, size_t len, const TestCase& tc) {
+        cvs::daltonlens::SimulateVienot1999(tc.deficiency, tc.severity, src,
+                                            dst, len);
+      });
+
+  check(
+      "daltonlens_daltonize_brettel1997", im_input,
+      [](const Image& src, Image& dst, const TestCase& tc) {
+        cvs::daltonlens::DaltonizeBrettel1997(
+            tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+            src.pixels.size());
+      },
+      brettel1997_daltonized, 1);
+
+  check(
+      "daltonlens_daltonize_vienot1999", im_input,
+      [](const Image& src, Image& dst, const TestCase& tc) {
+        cvs::daltonlens::DaltonizeVienot1999(
+            tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+            src.pixels.size());
+      },
+      vienot1999_daltonized, 1);
+
+#ifdef CVS_HAS_OPENMP
+  check(
+      "daltonlens_omp_daltonize_brettel1997", im_input,
+      [](const Image& src, Image& dst, const TestCase& tc) {
+        cvs::daltonlens_omp::DaltonizeBrettel1997(
+            tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+            src.pixels.size());
+      },
+      brettel1997_daltonized, 1);
+
+  check(
+      "daltonlens_omp_daltonize_vienot1999", im_input,
+      [](const Image& src, Image& dst, const TestCase& tc) {
+        cvs::daltonlens_omp::DaltonizeVienot1999(
+            tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+            src.pixels.size());
+      },
+      vienot1999_daltonized, 1);
+#endif
+
+  check(
+      "daltonlens_par_daltonize_brettel1997", im_input,
+      [](const Image& src, Image& dst, const TestCase& tc) {
+        cvs::daltonlens_par::DaltonizeBrettel1997(
+            tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+            src.pixels.size());
+      },
+      brettel1997_daltonized, 1);
+
+  check(
+      "daltonlens_par_daltonize_vienot1999", im_input,
+      [](const Image& src, Image& dst, const TestCase& tc) {
+        cvs::daltonlens_par::DaltonizeVienot1999(
+            tc.deficiency, tc.severity, src.pixels.data(), dst.pixels.data(),
+            src.pixels.size());
+      },
+      vienot1999_daltonized, 1);
+
+  // Deduplication must give exactly the direct result, also when the image
+  // has more colours than the table holds and it falls back to the direct
+  // path.
+  {
+    const auto brettel1997 = [](const Image& src, Image& dst,
+                                const TestCase& tc) {
+      cvs::daltonlens::SimulateBrettel1997(tc.deficiency, tc.severity,
+                                           src.pixels.data(),
+                                           dst.pixels.data(),
+                                           src.pixels.size());
+    };
+    const auto palette = palette_image(1024, 1024, 3000);
+    check("dedup_brettel1997", palette, dedup({}, true), brettel1997, 0);
+
+    cvs::dedup::Options small_table;
+    small_table.max_unique = 1000;
+    check("dedup_overflow_brettel1997", palette, dedup(small_table, false),
+          brettel1997, 0);
+  }
+
+  // Incremental
+  test(input_dir, output_dir, "daltonlens_incremental", "vienot1999",
+       [](const Image& src, Image& dst, const TestCase& tc) {
+         cvs::IncrementalSimulator sim(
+             src.width, src.height,
+             [&](const cvs::BGRA* s, cvs::BGRA* d, size_t len) {
+               cvs::daltonlens::SimulateVienot1999(tc.deficiency, tc.severity,
+                                                   s, d, len);
+             });
+
+         // The first frame differs in the upper half only, so the second one
+         // recomputes that half and keeps the lower half from the first.
+         Image first(src.width, src.height);
+         std::copy(src.pixels.begin(), src.pixels.end(), first.pixels.begin());
+         std::fill(first.pixels.begin(),
+                   first.pixels.begin() + first.pixels.size() / 2,
+                   cvs::BGRA{ 0, 0, 0, 255 });
+         sim.Process(first.pixels.data());
+         const auto out = sim.Process(src.pixels.data());
+         std::copy(out, out + src.pixels.size(), dst.pixels.begin());
+
+         // Same again through the caller-supplied dirty rectangles.
+         sim.Process(first.pixels.data());
+         const std::vector<cvs::Rect> dirty = {
+           { 0, 0, src.width, src.height / 2 },
+         };
+         const auto out_rect = sim.Process(src.pixels.data(), &dirty);
+         if (std::memcmp(dst.pixels.data(), out_rect,
+                         src.pixels.size() * sizeof(cvs::BGRA)) != 0) {
+           failures++;
+           std::cout << "incremental: dirty rect output differs" << std::endl;
+         }
+       });
+
+  // Streaming
+  test(input_dir, output_dir, "daltonlens_stream", "brettel1997",
+       [&](const Image& src, Image& dst, const TestCase& tc) {
+         const auto raw_in = (output_dir / "stream_in.raw").string();
+         const auto raw_out = (output_dir / "stream_out.raw").string();
+         cvs::stream::WriteRawFile(raw_in, src.width, src.height,
+                                   src.pixels.data());
+
+         // Small chunks so that the image spans several of them.
+         cvs::stream::Options opt;
+         opt.chunk_bytes = 1000 * sizeof(cvs::BGRA);
+         const auto simulate = [&](const cvs::BGRA* s, cvs::BGRA* d,
+                                   size_t len) {
+           cvs::daltonlens::SimulateBrettel1997(tc.deficiency, tc.severity, s,
+                                                d, len);
+         };
+         if (!cvs::stream::Process(raw_in, raw_out, simulate, opt, nullptr)) {
+           failures++;
+           std::cout << "stream: Process failed" << std::endl;
+         }
+
+         cvs::stream::RawHeader header;
+         std::vector<cvs::BGRA> pixels;
+         if (!cvs::stream::ReadRawFile(raw_out, header, pixels) ||
+             pixels.size() != src.pixels.size()) {
+           failures++;
+           std::cout << "stream: cannot read the output" << std::endl;
+           return;
+         }
+
+         // Writing onto the input itself is refused before it is truncated.
+         const auto in_size = fs::file_size(raw_in);
+         if (cvs::stream::Process(raw_in, raw_in, simulate, opt, nullptr) ||
+             fs::file_size(raw_in) != in_size) {
+           failures++;
+           std::cout << "stream: output onto the input accepted" << std::endl;
+         }
+
+         // A truncated input is rejected in both modes, not mapped past its
+         // end.
+         fs::resize_file(raw_in, fs::file_size(raw_in) / 2);
+         for (const auto mode :
+              { cvs::stream::IOMode::Mmap, cvs::stream::IOMode::Read }) {
+           opt.mode = mode;
+           if (cvs::stream::Process(raw_in, raw_out, simulate, opt, nullptr)) {
+             failures++;
+             std::cout << "stream: truncated input accepted" << std::endl;
+           }
+         }
+
+         std::copy(pixels.begin(), pixels.end(), dst.pixels.begin());
+       });
+
+  // Frame pool: a released frame comes back for the same size only.
+  {
+    cvs::FramePool pool({}, 2);
+    auto a = pool.Acquire(1000);
+    auto b = pool.Acquire(1000);
+    const cvs::BGRA* a_pixels = a.data();
+    bool ok = a.size() == 1000 && b.size() == 1000 && a.data() != b.data() &&
+              cvs::IsFrameAligned(a.data());
+    pool.Release(std::move(a));
+
+    const auto other = pool.Acquire(2000);
+    ok = ok && other.size() == 2000 && other.data() != a_pixels;
+    const auto reused = pool.Acquire(1000);
+    ok = ok && reused.data() == a_pixels;
+
+    // A full pool evicts its oldest frame, not the one being released.
+    cvs::FramePool small({}, 1);
+    auto c = small.Acquire(1000);
+    auto d = small.Acquire(2000);
+    const cvs::BGRA* d_pixels = d.data();
+    small.Release(std::move(c));
+    small.Release(std::move(d));
+    ok = ok && small.Acquire(2000).data() == d_pixels;
+    if (!ok) {
+      failures++;
+      std::cout << "frame_pool: frames are not recycled by size" << std::endl;
+    }
+  }
+
+#ifdef CVS_HAS_OPENCL
   // OpenCL
   {
     cl::Context context(CL_DEVICE_TYPE_DEFAULT);
-    cl::CommandQueue queue(context);
-    cvs::daltonlens_cl::Simulator sim(context, queue);
+    cvs::daltonlens_cl::Simulator sim(context);
 
     test(input_dir, output_dir, "daltonlens_cl", "brettel1997",
          [&](const Image& src, Image& dst, const TestCase& tc) {
@@ -182,7 +647,62 @@ int main(int argc, const char* argv[]) {
            sim.Vienot1999(tc.deficiency, tc.severity, src.pixels.data(),
                           dst.pixels.data(), src.pixels.size());
          });
+
+    test(input_dir, output_dir, "daltonlens_cl", "machado2009",
+         [&](const Image& src, Image& dst, const TestCase& tc) {
+           sim.Machado2009(tc.deficiency, tc.severity, src.pixels.data(),
+                           dst.pixels.data(), src.pixels.size());
+         });
+
+    // Four threads share the simulator, each on a quarter of the image.
+    test(input_dir, output_dir, "daltonlens_cl_shared", "brettel1997",
+         [&](const Image& src, Image& dst, const TestCase& tc) {
+           const size_t len = src.pixels.size();
+           std::vector<std::thread> threads;
+           for (size_t t = 0; t < 4; t++) {
+             const size_t begin = len * t / 4;
+             const size_t end = len * (t + 1) / 4;
+             threads.emplace_back([&, begin, end] {
+               sim.Brettel1997(tc.deficiency, tc.severity,
+                               src.pixels.data() + begin,
+                               dst.pixels.data() + begin, end - begin);
+             });
+           }
+           for (auto& thread : threads) thread.join();
+         });
+
+    // Empty frames are accepted like on the CPU; OpenCL would reject the
+    // zero-size buffers.
+    const cvs::BGRA* no_pixels = nullptr;
+    const float* no_floats = nullptr;
+    sim.Vienot1999(cvs::Deficiency::Protan, 1.f, no_pixels, nullptr, 0);
+    sim.Vienot1999(cvs::Deficiency::Protan, 1.f, no_floats, nullptr, 0);
+
+    check(
+        "daltonlens_cl_daltonize_brettel1997", im_input,
+        [&](const Image& src, Image& dst, const TestCase& tc) {
+          sim.DaltonizeBrettel1997(tc.deficiency, tc.severity,
+                                   src.pixels.data(), dst.pixels.data(),
+                                   src.pixels.size());
+        },
+        brettel1997_daltonized, 1);
+
+    check(
+        "daltonlens_cl_daltonize_vienot1999", im_input,
+        [&](const Image& src, Image& dst, const TestCase& tc) {
+          sim.DaltonizeVienot1999(tc.deficiency, tc.severity,
+                                  src.pixels.data(), dst.pixels.data(),
+                                  src.pixels.size());
+        },
+        vienot1999_daltonized, 1);
+
+    test(input_dir, output_dir, "daltonlens_cl_linear", "brettel1997",
+         linear<float>(4, 4, [&](const float* src, float* dst, size_t len,
+                                 const TestCase& tc) {
+           sim.Brettel1997(tc.deficiency, tc.severity, src, dst, len);
+         }));
   }
+#endif
 
-  return 0;
+  return failures == 0 ? 0 : 1;
 }
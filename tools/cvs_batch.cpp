@@ -0,0 +1,585 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include "cvs.h"
+#include "daltonlens.h"
+#ifdef CVS_HAS_OPENMP
+#include "daltonlens_omp.h"
+#endif
+#include "daltonlens_par.h"
+#include "dedup.h"
+#include "frame_buffer.h"
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+// Pixels come from a FramePool shared by all stages and go back to it once
+// the frame has been simulated or written.
+struct Image {
+  int width;
+  int height;
+  cvs::FrameBuffer pixels;
+};
+
+struct Variant {
+  cvs::Deficiency deficiency;
+  float severity;
+  std::string param_str;
+};
+
+// An input image and its output name: the path relative to the output
+// directory without the method/param suffix and extension.
+struct Input {
+  fs::path path;
+  fs::path name;
+};
+
+struct DecodedJob {
+  fs::path name;
+  Image image;
+};
+
+struct EncodeJob {
+  fs::path path;
+  Image image;
+};
+
+using SimFunc = std::function<void(cvs::Deficiency, float, const cvs::BGRA*,
+                                   cvs::BGRA*, size_t)>;
+
+// Blocking FIFO with a fixed capacity. Push blocks while the queue is full so
+// a fast stage cannot run ahead of a slow one and pile up decoded frames.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+  void Push(T&& item) {
+    std::unique_lock lock(mutex);
+    not_full.wait(lock, [&] { return items.size() < capacity; });
+    items.push(std::move(item));
+    not_empty.notify_one();
+  }
+
+  // Returns std::nullopt once the queue is closed and drained.
+  std::optional<T> Pop() {
+    std::unique_lock lock(mutex);
+    not_empty.wait(lock, [&] { return !items.empty() || closed; });
+    if (items.empty()) return std::nullopt;
+    T item = std::move(items.front());
+    items.pop();
+    not_full.notify_one();
+    return item;
+  }
+
+  void Close() {
+    std::lock_guard lock(mutex);
+    closed = true;
+    not_empty.notify_all();
+  }
+
+ private:
+  size_t capacity;
+  std::queue<T> items;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+};
+
+// Busy time of every worker in a stage, excluding time spent blocked on the
+// neighbouring queues.
+struct StageStats {
+  std::string name;
+  int workers;
+  std::atomic<int64_t> busy_ns = 0;
+  std::atomic<size_t> items = 0;
+
+  StageStats(std::string name, int workers)
+      : name(std::move(name)), workers(workers) {}
+
+  void Add(Clock::time_point start) {
+    busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   Clock::now() - start)
+                   .count();
+    items++;
+  }
+};
+
+struct Options {
+  std::string impl = "daltonlens";
+  std::string method = "brettel1997";
+  std::vector<cvs::Deficiency> deficiencies = {
+    cvs::Deficiency::Protan,
+    cvs::Deficiency::Deutan,
+    cvs::Deficiency::Tritan,
+  };
+  std::vector<std::string> severities = { "1.0" };
+  int decoders = 0;
+  int simulators = 0;
+  int encoders = 0;
+  size_t queue_size = 0;
+  bool dedup = false;
+  fs::path input;
+  fs::path output_dir;
+};
+
+std::optional<Image> load_image(const fs::path& p, cvs::FramePool& frames) {
+  int width, height, comp;
+  auto raw = stbi_load(p.string().c_str(), &width, &height, &comp, 4);
+  if (!raw) {
+    return std::nullopt;
+  }
+
+  Image im{ width, height, frames.Acquire(size_t(width) * height) };
+  for (size_t i = 0; i < im.pixels.size(); i++) {
+    im.pixels[i] = cvs::BGRA{
+      raw[i * 4 + 2],
+      raw[i * 4 + 1],
+      raw[i * 4 + 0],
+      raw[i * 4 + 3],
+    };
+  }
+
+  stbi_image_free(raw);
+
+  return im;
+}
+
+bool write_image(const fs::path& p, const Image& im) {
+  std::vector<stbi_uc> raw(im.pixels.size() * 4);
+  for (size_t i = 0; i < im.pixels.size(); i++) {
+    raw[i * 4 + 0] = im.pixels[i].r;
+    raw[i * 4 + 1] = im.pixels[i].g;
+    raw[i * 4 + 2] = im.pixels[i].b;
+    raw[i * 4 + 3] = im.pixels[i].a;
+  }
+  return stbi_write_png(p.string().c_str(), im.width, im.height, 4,
+                        raw.data(), 0) != 0;
+}
+
+std::vector<std::string> split(const std::string& s, char delim) {
+  std::vector<std::string> tokens;
+  size_t begin = 0;
+  while (begin <= s.size()) {
+    size_t end = s.find(delim, begin);
+    if (end == std::string::npos) end = s.size();
+    if (end > begin) tokens.push_back(s.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return tokens;
+}
+
+std::optional<cvs::Deficiency> parse_deficiency(const std::string& s) {
+  if (s == "protan") return cvs::Deficiency::Protan;
+  if (s == "deutan") return cvs::Deficiency::Deutan;
+  if (s == "tritan") return cvs::Deficiency::Tritan;
+  return std::nullopt;
+}
+
+std::string deficiency_name(cvs::Deficiency deficiency) {
+  switch (deficiency) {
+    case cvs::Deficiency::Protan:
+      return "protan";
+    case cvs::Deficiency::Deutan:
+      return "deutan";
+    case cvs::Deficiency::Tritan:
+      return "tritan";
+  }
+  return "unknown";
+}
+
+std::optional<SimFunc> select_simulator(const std::string& impl,
+                                        const std::string& method) {
+  if (impl == "daltonlens") {
+    if (method == "brettel1997") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    }
+    if (method == "vienot1999") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateVienot1999(d, s, src, dst, len);
+      };
+    }
+    if (method == "machado2009") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateMachado2009(d, s, src, dst, len);
+      };
+    }
+#ifdef CVS_HAS_OPENMP
+  } else if (impl == "daltonlens_omp") {
+    if (method == "brettel1997") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    }
+    if (method == "vienot1999") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateVienot1999(d, s, src, dst, len);
+      };
+    }
+    if (method == "machado2009") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateMachado2009(d, s, src, dst, len);
+      };
+    }
+#endif
+  } else if (impl == "daltonlens_par") {
+    if (method == "brettel1997") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    }
+    if (method == "vienot1999") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateVienot1999(d, s, src, dst, len);
+      };
+    }
+    if (method == "machado2009") {
+      return [](cvs::Deficiency d, float s, const cvs::BGRA* src,
+                cvs::BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateMachado2009(d, s, src, dst, len);
+      };
+    }
+  }
+  return std::nullopt;
+}
+
+// Keeps the directory of an input relative to base so that same-stem images
+// from different directories get different outputs. Inputs outside base are
+// flattened; collisions among them are caught by the caller.
+fs::path output_name(const fs::path& path, const fs::path& base) {
+  const auto rel = fs::absolute(path).lexically_relative(fs::absolute(base));
+  auto dir = rel.parent_path();
+  if (rel.empty() || (!dir.empty() && *dir.begin() == "..")) dir.clear();
+  return dir / path.stem();
+}
+
+// A directory is scanned for images, anything else is read as a list file
+// with one path per line, relative to the current directory. List entries
+// that are not readable files are reported and counted in `unreadable`.
+std::optional<std::vector<Input>> collect_inputs(const fs::path& input,
+                                                 size_t& unreadable) {
+  std::vector<fs::path> paths;
+  if (!fs::exists(input)) {
+    std::cerr << "no such input: " << input.string() << std::endl;
+    return std::nullopt;
+  }
+  if (fs::is_directory(input)) {
+    for (const auto& entry : fs::directory_iterator(input)) {
+      if (!entry.is_regular_file()) continue;
+      auto ext = entry.path().extension().string();
+      std::transform(ext.begin(), ext.end(), ext.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" ||
+          ext == ".tga") {
+        paths.push_back(entry.path());
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+  } else {
+    std::ifstream ifs(input);
+    if (!ifs.is_open()) {
+      std::cerr << "cannot open list file: " << input.string() << std::endl;
+      return std::nullopt;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (line.empty()) continue;
+      if (!fs::is_regular_file(line)) {
+        std::cerr << "cannot read: " << line << std::endl;
+        unreadable++;
+        continue;
+      }
+      paths.emplace_back(line);
+    }
+    if (ifs.bad()) {
+      std::cerr << "cannot read list file: " << input.string() << std::endl;
+      return std::nullopt;
+    }
+  }
+
+  const auto base = fs::is_directory(input) ? input : fs::current_path();
+  std::vector<Input> inputs;
+  for (auto& path : paths) {
+    auto name = output_name(path, base);
+    inputs.push_back(Input{ std::move(path), std::move(name) });
+  }
+  return inputs;
+}
+
+// Two inputs with the same output name (e.g. a.png and a.jpg) would overwrite
+// each other's results, so they are rejected before anything is processed.
+bool check_output_names(const std::vector<Input>& inputs) {
+  std::map<fs::path, const fs::path*> seen;
+  bool ok = true;
+  for (const auto& input : inputs) {
+    const auto [it, inserted] = seen.emplace(input.name, &input.path);
+    if (!inserted) {
+      std::cerr << "output name collision: " << it->second->string()
+                << " and " << input.path.string() << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+void usage() {
+  std::cout
+      << "Usage: cvs_batch [options] <input dir|list file> <output dir>\n"
+         "  --impl <daltonlens|daltonlens_omp|daltonlens_par>\n"
+         "                                      (default: daltonlens)\n"
+         "  --method <brettel1997|vienot1999|machado2009>\n"
+         "  --deficiency <protan,deutan,tritan> (default: all)\n"
+         "  --severity <s1,s2,...>              (default: 1.0)\n"
+         "  --decoders <n> --simulators <n> --encoders <n>\n"
+         "  --queue <n>                         (frames per stage queue)\n"
+         "  --dedup                             (simulate unique colours only)"
+      << std::endl;
+}
+
+std::optional<Options> parse_args(int argc, const char* argv[]) {
+  Options opt;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--dedup") {
+      opt.dedup = true;
+    } else if (arg.starts_with("--")) {
+      if (i + 1 >= argc) return std::nullopt;
+      const std::string value = argv[++i];
+      if (arg == "--impl") {
+        opt.impl = value;
+      } else if (arg == "--method") {
+        opt.method = value;
+      } else if (arg == "--deficiency") {
+        opt.deficiencies.clear();
+        for (const auto& s : split(value, ',')) {
+          auto d = parse_deficiency(s);
+          if (!d) return std::nullopt;
+          opt.deficiencies.push_back(*d);
+        }
+      } else if (arg == "--severity") {
+        opt.severities = split(value, ',');
+      } else if (arg == "--decoders") {
+        opt.decoders = std::atoi(value.c_str());
+      } else if (arg == "--simulators") {
+        opt.simulators = std::atoi(value.c_str());
+      } else if (arg == "--encoders") {
+        opt.encoders = std::atoi(value.c_str());
+      } else if (arg == "--queue") {
+        opt.queue_size = std::atoi(value.c_str());
+      } else {
+        return std::nullopt;
+      }
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (positional.size() != 2 || opt.deficiencies.empty() ||
+      opt.severities.empty()) {
+    return std::nullopt;
+  }
+  opt.input = positional[0];
+  opt.output_dir = positional[1];
+
+  // PNG encoding is the most expensive stage, decoding is next. The OpenMP
+  // and parallel algorithms backends parallelise a single frame themselves,
+  // so one simulator is enough.
+  const int cores = std::max(1u, std::thread::hardware_concurrency());
+  if (opt.simulators <= 0) {
+    const bool parallel =
+        opt.impl == "daltonlens_omp" || opt.impl == "daltonlens_par";
+    opt.simulators = parallel ? 1 : std::max(1, cores / 4);
+  }
+  if (opt.decoders <= 0) opt.decoders = std::max(1, cores / 4);
+  if (opt.encoders <= 0) opt.encoders = std::max(1, cores / 2);
+  if (opt.queue_size == 0) {
+    opt.queue_size = 2 * std::max({ opt.decoders, opt.simulators,
+                                    opt.encoders });
+  }
+  return opt;
+}
+
+int main(int argc, const char* argv[]) {
+  const auto opt = parse_args(argc, argv);
+  if (!opt) {
+    usage();
+    return 1;
+  }
+
+  auto simulate = select_simulator(opt->impl, opt->method);
+  if (!simulate) {
+    std::cerr << std::format("unknown impl/method: {}/{}", opt->impl,
+                             opt->method)
+              << std::endl;
+    return 1;
+  }
+  if (opt->dedup) {
+    // Falls back to the direct path per image when the palette is large.
+    simulate = [direct = *simulate](cvs::Deficiency d, float s,
+                                    const cvs::BGRA* src, cvs::BGRA* dst,
+                                    size_t len) {
+      cvs::dedup::Simulate(
+          [&](const cvs::BGRA* s_src, cvs::BGRA* s_dst, size_t n) {
+            direct(d, s, s_src, s_dst, n);
+          },
+          src, dst, len);
+    };
+  }
+
+  std::vector<Variant> variants;
+  for (const auto deficiency : opt->deficiencies) {
+    for (const auto& severity : opt->severities) {
+      variants.push_back(Variant{
+        deficiency,
+        std::strtof(severity.c_str(), nullptr),
+        std::format("{}_{}", deficiency_name(deficiency), severity),
+      });
+    }
+  }
+
+  size_t unreadable = 0;
+  const auto collected = collect_inputs(opt->input, unreadable);
+  if (!collected) return 1;
+  const auto& inputs = *collected;
+  if (!check_output_names(inputs)) return 1;
+  for (const auto& input : inputs) {
+    fs::create_directories(opt->output_dir / input.name.parent_path());
+  }
+
+  // Every frame in flight sits in a queue or with a worker. Frames are fully
+  // overwritten, so zeroing them from OpenMP threads would be wasted work.
+  cvs::FramePool frames(
+      cvs::FrameBufferOptions{ cvs::HugePages::Transparent, false },
+      2 * opt->queue_size + opt->decoders + opt->simulators + opt->encoders);
+  BoundedQueue<DecodedJob> decoded(opt->queue_size);
+  BoundedQueue<EncodeJob> encoded(opt->queue_size);
+  StageStats decode_stats("decode", opt->decoders);
+  StageStats simulate_stats("simulate", opt->simulators);
+  StageStats encode_stats("encode", opt->encoders);
+  std::atomic<size_t> next_input = 0;
+  std::atomic<size_t> failures = unreadable;
+
+  const auto start = Clock::now();
+
+  std::vector<std::thread> decoders;
+  for (int i = 0; i < opt->decoders; i++) {
+    decoders.emplace_back([&] {
+      for (size_t n = next_input++; n < inputs.size(); n = next_input++) {
+        const auto t = Clock::now();
+        auto im = load_image(inputs[n].path, frames);
+        decode_stats.Add(t);
+        if (!im) {
+          std::cerr << "failed to load: " << inputs[n].path.string()
+                    << std::endl;
+          failures++;
+          continue;
+        }
+        decoded.Push(DecodedJob{ inputs[n].name, std::move(*im) });
+      }
+    });
+  }
+
+  std::vector<std::thread> simulators;
+  for (int i = 0; i < opt->simulators; i++) {
+    simulators.emplace_back([&] {
+      while (auto job = decoded.Pop()) {
+        const auto& src = job->image;
+        for (const auto& v : variants) {
+          const auto t = Clock::now();
+          Image dst{
+            src.width,
+            src.height,
+            frames.Acquire(src.pixels.size()),
+          };
+          (*simulate)(v.deficiency, v.severity, src.pixels.data(),
+                      dst.pixels.data(), src.pixels.size());
+          simulate_stats.Add(t);
+          const auto filename =
+              std::format("{}_{}_{}.png", job->name.filename().string(),
+                          opt->method, v.param_str);
+          encoded.Push(EncodeJob{
+            opt->output_dir / job->name.parent_path() / filename,
+            std::move(dst),
+          });
+        }
+        frames.Release(std::move(job->image.pixels));
+      }
+    });
+  }
+
+  std::vector<std::thread> encoders;
+  for (int i = 0; i < opt->encoders; i++) {
+    encoders.emplace_back([&] {
+      while (auto job = encoded.Pop()) {
+        const auto t = Clock::now();
+        const bool ok = write_image(job->path, job->image);
+        encode_stats.Add(t);
+        frames.Release(std::move(job->image.pixels));
+        if (!ok) {
+          std::cerr << "failed to write: " << job->path.string() << std::endl;
+          failures++;
+        }
+      }
+    });
+  }
+
+  for (auto& th : decoders) th.join();
+  decoded.Close();
+  for (auto& th : simulators) th.join();
+  encoded.Close();
+  for (auto& th : encoders) th.join();
+
+  const double wall =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  const size_t images = simulate_stats.items / variants.size();
+
+  std::cout << std::format(
+                   "images: {}, outputs: {}, failures: {}, time: {:.3f} s",
+                   images, encode_stats.items.load(), failures.load(), wall)
+            << std::endl;
+  std::cout << std::format("throughput: {:.2f} images/s, {:.2f} outputs/s",
+                           images / wall, encode_stats.items / wall)
+            << std::endl;
+  for (const auto* stage : { &decode_stats, &simulate_stats, &encode_stats }) {
+    const double busy = stage->busy_ns / 1e9;
+    std::cout << std::format(
+                     "stage: {:<8} workers: {:>3}, utilization: {:5.1f} %",
+                     stage->name, stage->workers,
+                     100.0 * busy / (wall * stage->workers))
+              << std::endl;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,364 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cvs.h"
+#include "daltonlens.h"
+#ifdef CVS_HAS_OPENCL
+#include "daltonlens_cl.h"
+#endif
+#ifdef CVS_HAS_OPENMP
+#include "daltonlens_omp.h"
+#endif
+#include "daltonlens_par.h"
+#include "server.h"
+
+using cvs::BGRA;
+using cvs::Deficiency;
+using cvs::server::FrameRequest;
+using cvs::server::Method;
+
+struct Options {
+  std::string name = cvs::server::kDefaultName;
+  std::string impl = "daltonlens_par";
+  int report_seconds = 5;
+  // Forks this many clients that check their frames, then exits.
+  int selftest = 0;
+  int frames = 30;
+  int width = 640;
+  int height = 480;
+};
+
+std::optional<cvs::server::Engine> select_engine(const std::string& impl) {
+  if (impl == "daltonlens") {
+    return [](const FrameRequest& req, const BGRA* src, BGRA* dst) {
+      const auto d = req.deficiency;
+      const auto s = req.severity;
+      switch (req.method) {
+        case Method::Brettel1997:
+          cvs::daltonlens::SimulateBrettel1997(d, s, src, dst, req.len);
+          break;
+        case Method::Vienot1999:
+          cvs::daltonlens::SimulateVienot1999(d, s, src, dst, req.len);
+          break;
+        case Method::Machado2009:
+          cvs::daltonlens::SimulateMachado2009(d, s, src, dst, req.len);
+          break;
+      }
+    };
+  }
+#ifdef CVS_HAS_OPENMP
+  if (impl == "daltonlens_omp") {
+    return [](const FrameRequest& req, const BGRA* src, BGRA* dst) {
+      const auto d = req.deficiency;
+      const auto s = req.severity;
+      const int len = req.len;
+      switch (req.method) {
+        case Method::Brettel1997:
+          cvs::daltonlens_omp::SimulateBrettel1997(d, s, src, dst, len);
+          break;
+        case Method::Vienot1999:
+          cvs::daltonlens_omp::SimulateVienot1999(d, s, src, dst, len);
+          break;
+        case Method::Machado2009:
+          cvs::daltonlens_omp::SimulateMachado2009(d, s, src, dst, len);
+          break;
+      }
+    };
+  }
+#endif
+  if (impl == "daltonlens_par") {
+    return [](const FrameRequest& req, const BGRA* src, BGRA* dst) {
+      const auto d = req.deficiency;
+      const auto s = req.severity;
+      switch (req.method) {
+        case Method::Brettel1997:
+          cvs::daltonlens_par::SimulateBrettel1997(d, s, src, dst, req.len);
+          break;
+        case Method::Vienot1999:
+          cvs::daltonlens_par::SimulateVienot1999(d, s, src, dst, req.len);
+          break;
+        case Method::Machado2009:
+          cvs::daltonlens_par::SimulateMachado2009(d, s, src, dst, req.len);
+          break;
+      }
+    };
+  }
+#ifdef CVS_HAS_OPENCL
+  if (impl == "daltonlens_cl") {
+    // The program is built once here and shared by every client. Frames are
+    // served one at a time, so one set of queue and kernels is enough.
+    cl::Context context(CL_DEVICE_TYPE_DEFAULT);
+    auto sim = std::make_shared<cvs::daltonlens_cl::Simulator>(context, 1);
+    return [sim](const FrameRequest& req, const BGRA* src, BGRA* dst) {
+      const auto d = req.deficiency;
+      const auto s = req.severity;
+      switch (req.method) {
+        case Method::Brettel1997:
+          sim->Brettel1997(d, s, src, dst, req.len);
+          break;
+        case Method::Vienot1999:
+          sim->Vienot1999(d, s, src, dst, req.len);
+          break;
+        case Method::Machado2009:
+          sim->Machado2009(d, s, src, dst, req.len);
+          break;
+      }
+    };
+  }
+#endif
+  return std::nullopt;
+}
+
+// Runs every method once so that the first client frame does not pay for
+// lazy initialisation.
+void warm_up(const cvs::server::Engine& engine) {
+  std::vector<BGRA> src(4096, BGRA{ 10, 20, 30, 255 });
+  std::vector<BGRA> dst(src.size());
+  for (auto method :
+       { Method::Brettel1997, Method::Vienot1999, Method::Machado2009 }) {
+    engine(FrameRequest{ method, Deficiency::Protan, 1.f, src.size() },
+           src.data(), dst.data());
+  }
+}
+
+FrameRequest selftest_request(int frame, size_t len) {
+  return FrameRequest{
+    Method(frame % 3),
+    Deficiency((frame / 3) % 3),
+    float(frame % 5 + 1) / 5.f,
+    len,
+  };
+}
+
+void expected_output(const FrameRequest& req, const BGRA* src, BGRA* dst) {
+  const auto d = req.deficiency;
+  const auto s = req.severity;
+  switch (req.method) {
+    case Method::Brettel1997:
+      cvs::daltonlens::SimulateBrettel1997(d, s, src, dst, req.len);
+      break;
+    case Method::Vienot1999:
+      cvs::daltonlens::SimulateVienot1999(d, s, src, dst, req.len);
+      break;
+    case Method::Machado2009:
+      cvs::daltonlens::SimulateMachado2009(d, s, src, dst, req.len);
+      break;
+  }
+}
+
+// Client stand-in: keeps the ring full, and checks every frame against the
+// serial backend, allowing the rounding differences of the GPU.
+int run_client(const Options& opt, int index) {
+  const size_t len = size_t(opt.width) * opt.height;
+  auto client = cvs::server::Client::Connect(opt.name, len);
+  if (!client) {
+    std::cerr << std::format("client {}: cannot connect to {}", index,
+                             opt.name)
+              << std::endl;
+    return 1;
+  }
+
+  std::mt19937 mt(index);
+  std::deque<std::vector<BGRA>> inputs;
+  std::vector<BGRA> expected(len);
+  int sent = 0;
+  int received = 0;
+  while (received < opt.frames) {
+    while (sent < opt.frames) {
+      BGRA* in = client->BeginFrame();
+      if (!in) break;
+      auto& copy = inputs.emplace_back(len);
+      for (auto& px : copy) {
+        const uint32_t v = mt();
+        px = BGRA{ uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), 255 };
+      }
+      std::copy(copy.begin(), copy.end(), in);
+      client->Submit(selftest_request(sent, len));
+      sent++;
+    }
+
+    const BGRA* out = nullptr;
+    const auto result = client->WaitFrame(std::chrono::seconds(30), out);
+    if (result == cvs::server::Client::WaitResult::Rejected) {
+      std::cerr << std::format("client {}: frame {} rejected", index,
+                               received)
+                << std::endl;
+      return 1;
+    }
+    if (result != cvs::server::Client::WaitResult::Ok) {
+      std::cerr << std::format("client {}: no answer for frame {}", index,
+                               received)
+                << std::endl;
+      return 1;
+    }
+    expected_output(selftest_request(received, len), inputs.front().data(),
+                    expected.data());
+    for (size_t i = 0; i < len; i++) {
+      if (std::abs(out[i].r - expected[i].r) > 1 ||
+          std::abs(out[i].g - expected[i].g) > 1 ||
+          std::abs(out[i].b - expected[i].b) > 1 || out[i].a != 255) {
+        std::cerr << std::format("client {}: frame {} differs at pixel {}",
+                                 index, received, i)
+                  << std::endl;
+        return 1;
+      }
+    }
+    client->ReleaseFrame();
+    inputs.pop_front();
+    received++;
+  }
+
+  // A frame larger than the ring is rejected at once rather than timed out.
+  const BGRA* out = nullptr;
+  client->BeginFrame();
+  client->Submit(selftest_request(received, len + 1));
+  if (client->WaitFrame(std::chrono::seconds(30), out) !=
+      cvs::server::Client::WaitResult::Rejected) {
+    std::cerr << std::format("client {}: oversized frame not rejected",
+                             index)
+              << std::endl;
+    return 1;
+  }
+  client->ReleaseFrame();
+  return 0;
+}
+
+std::atomic<bool> g_stop{ false };
+
+void handle_signal(int) { g_stop = true; }
+
+void usage() {
+  std::cout
+      << "Usage: cvs_server [options]\n"
+         "  --name <shm name>                   (default: /cvs_server)\n"
+         "  --impl <daltonlens|daltonlens_omp|daltonlens_par|daltonlens_cl>\n"
+         "                                      (default: daltonlens_par)\n"
+         "  --report <seconds>                  (default: 5)\n"
+         "  --selftest <clients>                (fork clients and check)\n"
+         "  --frames <n> --size <width>x<height> (per selftest client)"
+      << std::endl;
+}
+
+std::optional<Options> parse_args(int argc, const char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) return std::nullopt;
+    const std::string value = argv[++i];
+    if (arg == "--name") {
+      opt.name = value;
+    } else if (arg == "--impl") {
+      opt.impl = value;
+    } else if (arg == "--report") {
+      opt.report_seconds = std::max(1, std::atoi(value.c_str()));
+    } else if (arg == "--selftest") {
+      opt.selftest = std::atoi(value.c_str());
+    } else if (arg == "--frames") {
+      opt.frames = std::atoi(value.c_str());
+    } else if (arg == "--size") {
+      char* end = nullptr;
+      opt.width = std::strtol(value.c_str(), &end, 10);
+      opt.height = *end == 'x' ? std::strtol(end + 1, nullptr, 10) : 0;
+      if (opt.width <= 0 || opt.height <= 0) return std::nullopt;
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (opt.name.empty() || opt.name[0] != '/') return std::nullopt;
+  return opt;
+}
+
+int main(int argc, const char* argv[]) {
+  const auto opt = parse_args(argc, argv);
+  if (!opt) {
+    usage();
+    return 1;
+  }
+
+  cvs::server::ServerOptions sopt;
+  sopt.report_interval = std::chrono::seconds(opt->report_seconds);
+  sopt.report = [](const cvs::server::ClientStats& st) {
+    std::cout << std::format(
+                     "client {}: {} frames, {:.1f} frames/s, {:.3f} GB/s, "
+                     "engine {:.1f}%{}",
+                     st.pid, st.frames, st.FramesPerSecond(), st.GBps(),
+                     st.connected_seconds > 0
+                         ? 100 * st.busy_seconds / st.connected_seconds
+                         : 0,
+                     st.connected ? "" : ", disconnected")
+              << std::endl;
+  };
+
+  // Clients are forked before any backend starts threads.
+  cvs::server::Server server(opt->name, sopt);
+  if (!server.Open()) {
+    std::cerr << std::format("cannot create {}, or a server is running on it",
+                             opt->name)
+              << std::endl;
+    return 1;
+  }
+  if (opt->selftest > 0 && cvs::server::Server(opt->name).Open()) {
+    std::cerr << "selftest: a second server replaced the running one"
+              << std::endl;
+    return 1;
+  }
+  std::vector<pid_t> children;
+  for (int i = 0; i < opt->selftest; i++) {
+    const pid_t pid = fork();
+    if (pid == 0) _exit(run_client(*opt, i));
+    if (pid < 0) {
+      std::cerr << "fork failed" << std::endl;
+      g_stop = true;
+      break;
+    }
+    children.push_back(pid);
+  }
+
+  auto engine = select_engine(opt->impl);
+  if (!engine) {
+    std::cerr << std::format("unknown impl: {}", opt->impl) << std::endl;
+    for (const pid_t pid : children) kill(pid, SIGTERM);
+    return 1;
+  }
+  warm_up(*engine);
+
+  if (children.empty()) {
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    std::cout << std::format("cvs_server: {} on {}", opt->impl, opt->name)
+              << std::endl;
+    server.Run(*engine, g_stop);
+    return 0;
+  }
+
+  // Self-test: serve until every client has exited.
+  int failed = 0;
+  std::thread reaper([&] {
+    for (const pid_t pid : children) {
+      int status = 0;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    g_stop = true;
+  });
+  server.Run(*engine, g_stop);
+  reaper.join();
+
+  std::cout << std::format("selftest: {} of {} clients passed",
+                           children.size() - failed, children.size())
+            << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include <climits>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cvs.h"
+#include "daltonlens.h"
+#ifdef CVS_HAS_OPENMP
+#include "daltonlens_omp.h"
+#endif
+#include "daltonlens_par.h"
+#include "stream.h"
+
+using cvs::BGRA;
+using cvs::Deficiency;
+
+struct Options {
+  std::string impl = "daltonlens";
+  std::string method = "brettel1997";
+  Deficiency deficiency = Deficiency::Protan;
+  float severity = 1.f;
+  cvs::stream::Options stream;
+  std::string generate;
+  std::vector<std::string> positional;
+};
+
+std::optional<Deficiency> parse_deficiency(const std::string& s) {
+  if (s == "protan") return Deficiency::Protan;
+  if (s == "deutan") return Deficiency::Deutan;
+  if (s == "tritan") return Deficiency::Tritan;
+  return std::nullopt;
+}
+
+// A whole decimal number in [min, max], nothing else.
+std::optional<long> parse_count(const std::string& s, long min, long max) {
+  char* end = nullptr;
+  const long v = std::strtol(s.c_str(), &end, 10);
+  if (s.empty() || *end != '\0' || v < min || v > max) return std::nullopt;
+  return v;
+}
+
+std::optional<cvs::stream::ChunkFunc> select_simulator(const Options& opt) {
+  const auto d = opt.deficiency;
+  const auto s = opt.severity;
+  if (opt.impl == "daltonlens") {
+    if (opt.method == "brettel1997") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    }
+    if (opt.method == "vienot1999") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateVienot1999(d, s, src, dst, len);
+      };
+    }
+    if (opt.method == "machado2009") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens::SimulateMachado2009(d, s, src, dst, len);
+      };
+    }
+#ifdef CVS_HAS_OPENMP
+  } else if (opt.impl == "daltonlens_omp") {
+    if (opt.method == "brettel1997") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    }
+    if (opt.method == "vienot1999") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateVienot1999(d, s, src, dst, len);
+      };
+    }
+    if (opt.method == "machado2009") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_omp::SimulateMachado2009(d, s, src, dst, len);
+      };
+    }
+#endif
+  } else if (opt.impl == "daltonlens_par") {
+    if (opt.method == "brettel1997") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateBrettel1997(d, s, src, dst, len);
+      };
+    }
+    if (opt.method == "vienot1999") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateVienot1999(d, s, src, dst, len);
+      };
+    }
+    if (opt.method == "machado2009") {
+      return [=](const BGRA* src, BGRA* dst, size_t len) {
+        cvs::daltonlens_par::SimulateMachado2009(d, s, src, dst, len);
+      };
+    }
+  }
+  return std::nullopt;
+}
+
+// Writes a raw file of random pixels one row at a time, so test inputs larger
+// than memory can be produced as well.
+bool generate(const std::string& path, uint32_t width, uint32_t height) {
+  if (!cvs::stream::CreateRawFile(path, width, height)) return false;
+  std::fstream ofs(path, std::ios::binary | std::ios::in | std::ios::out);
+  ofs.seekp(cvs::stream::kRawDataOffset);
+
+  std::mt19937 mt(width * 31 + height);
+  std::vector<uint32_t> row(width);
+  for (uint32_t y = 0; y < height; y++) {
+    for (auto& px : row) px = mt();
+    ofs.write(reinterpret_cast<const char*>(row.data()),
+              row.size() * sizeof(uint32_t));
+  }
+  return bool(ofs);
+}
+
+void usage() {
+  std::cout
+      << "Usage: cvs_stream [options] <input.raw> <output.raw>\n"
+         "       cvs_stream --generate <width>x<height> <output.raw>\n"
+         "  --impl <daltonlens|daltonlens_omp|daltonlens_par>\n"
+         "                                      (default: daltonlens)\n"
+         "  --method <brettel1997|vienot1999|machado2009>\n"
+         "  --deficiency <protan|deutan|tritan> (default: protan)\n"
+         "  --severity <s>                      (default: 1.0)\n"
+         "  --mode <mmap|read>                  (default: mmap)\n"
+         "  --chunk <MiB>                       (default: 64)\n"
+         "  --inflight <n>                      (default: 4)\n"
+         "  --no-sequential-hint"
+      << std::endl;
+}
+
+std::optional<Options> parse_args(int argc, const char* argv[]) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--no-sequential-hint") {
+      opt.stream.sequential_hint = false;
+    } else if (arg.starts_with("--")) {
+      if (i + 1 >= argc) return std::nullopt;
+      const std::string value = argv[++i];
+      if (arg == "--impl") {
+        opt.impl = value;
+      } else if (arg == "--method") {
+        opt.method = value;
+      } else if (arg == "--deficiency") {
+        auto d = parse_deficiency(value);
+        if (!d) return std::nullopt;
+        opt.deficiency = *d;
+      } else if (arg == "--severity") {
+        opt.severity = std::strtof(value.c_str(), nullptr);
+      } else if (arg == "--mode") {
+        if (value == "mmap") {
+          opt.stream.mode = cvs::stream::IOMode::Mmap;
+        } else if (value == "read") {
+          opt.stream.mode = cvs::stream::IOMode::Read;
+        } else {
+          return std::nullopt;
+        }
+      } else if (arg == "--chunk") {
+        const auto mib = parse_count(value, 1, long(SIZE_MAX >> 20));
+        if (!mib) return std::nullopt;
+        opt.stream.chunk_bytes = size_t(*mib) << 20;
+      } else if (arg == "--inflight") {
+        const auto n = parse_count(value, 1, INT_MAX);
+        if (!n) return std::nullopt;
+        opt.stream.in_flight = int(*n);
+      } else if (arg == "--generate") {
+        opt.generate = value;
+      } else {
+        return std::nullopt;
+      }
+    } else {
+      opt.positional.push_back(arg);
+    }
+  }
+  return opt;
+}
+
+int main(int argc, const char* argv[]) {
+  const auto opt = parse_args(argc, argv);
+  if (!opt) {
+    usage();
+    return 1;
+  }
+
+  if (!opt->generate.empty()) {
+    unsigned long width = 0, height = 0;
+    char* end = nullptr;
+    width = std::strtoul(opt->generate.c_str(), &end, 10);
+    if (*end == 'x') height = std::strtoul(end + 1, nullptr, 10);
+    if (width == 0 || height == 0 || opt->positional.size() != 1) {
+      usage();
+      return 1;
+    }
+    return generate(opt->positional[0], width, height) ? 0 : 1;
+  }
+
+  if (opt->positional.size() != 2) {
+    usage();
+    return 1;
+  }
+
+  const auto simulate = select_simulator(*opt);
+  if (!simulate) {
+    std::cerr << std::format("unknown impl/method: {}/{}", opt->impl,
+                             opt->method)
+              << std::endl;
+    return 1;
+  }
+
+  cvs::stream::Stats stats;
+  if (!cvs::stream::Process(opt->positional[0], opt->positional[1], *simulate,
+                            opt->stream, &stats)) {
+    std::cerr << "failed to process " << opt->positional[0] << std::endl;
+    return 1;
+  }
+
+  std::cout << std::format("bytes: {}, chunks: {}, time: {:.3f} s, {:.3f} GB/s",
+                           stats.bytes, stats.chunks, stats.seconds,
+                           stats.GBps())
+            << std::endl;
+  return 0;
+}